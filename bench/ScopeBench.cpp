@@ -0,0 +1,301 @@
+// Headless render benchmark for the Opsylloscope display, built and run with `make bench`.
+//
+// ScopeDisplay::preDrawWaveforms is run over a matrix of buffer sizes, channel counts, plot types,
+// line types, fade and kaleidoscope mirrors. It draws into a nanovg context whose renderer only counts
+// what it is handed, so nanovg's own path building and tessellation are timed but nothing is rasterised
+// and no GPU or window is needed.
+//
+// For each case it prints the time per frame and, per frame, the number of nanovg fill and stroke calls,
+// the paths and vertices they carry, and how many of them change paint, scissor, blending or width from
+// the call before, which is what would be a state change for the GL renderer.
+//
+// Before timing it checks that a sweep the ring is only partly filled for yields points for the filled
+// samples only, and exits with an error if not.
+//
+// Scope.cpp has no header, so it is compiled into the benchmark rather than linked.
+
+#include "../src/Scope.cpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+/// nanovg renderer that counts the draw calls it is given instead of drawing them
+struct CountingRenderer {
+	long fills = 0;
+	long strokes = 0;
+	long triangles = 0;
+	long paths = 0;
+	long vertices = 0;
+	long stateChanges = 0;
+
+	bool hasState = false;
+	NVGpaint paint;
+	NVGscissor scissor;
+	NVGcompositeOperationState composite;
+	float width = 0.f;
+
+	void reset() {
+		*this = CountingRenderer();
+	}
+
+	void state(const NVGpaint *paint, NVGcompositeOperationState composite, const NVGscissor *scissor, float width) {
+		if (!hasState || std::memcmp(paint, &this->paint, sizeof(NVGpaint)) != 0
+			|| std::memcmp(scissor, &this->scissor, sizeof(NVGscissor)) != 0
+			|| std::memcmp(&composite, &this->composite, sizeof(composite)) != 0 || width != this->width)
+			stateChanges++;
+		hasState = true;
+		this->paint = *paint;
+		this->scissor = *scissor;
+		this->composite = composite;
+		this->width = width;
+	}
+
+	static int create(void *) {
+		return 1;
+	}
+
+	static int createTexture(void *, int, int, int, int, const unsigned char *) {
+		return 1;
+	}
+
+	static int deleteTexture(void *, int) {
+		return 1;
+	}
+
+	static int updateTexture(void *, int, int, int, int, int, const unsigned char *) {
+		return 1;
+	}
+
+	static int getTextureSize(void *, int, int *w, int *h) {
+		*w = *h = 512;
+		return 1;
+	}
+
+	static void viewport(void *, float, float, float) {}
+
+	static void cancel(void *) {}
+
+	static void flush(void *) {}
+
+	static void drawFill(void *uptr, NVGpaint *paint, NVGcompositeOperationState composite, NVGscissor *scissor,
+					 float, const float *, const NVGpath *paths, int npaths) {
+		auto counts = (CountingRenderer *) uptr;
+		counts->fills++;
+		counts->paths += npaths;
+		for (auto i = 0; i < npaths; i++)
+			counts->vertices += paths[i].nfill + paths[i].nstroke;
+		counts->state(paint, composite, scissor, 0.f);
+	}
+
+	static void drawStroke(void *uptr, NVGpaint *paint, NVGcompositeOperationState composite, NVGscissor *scissor,
+					   float, float strokeWidth, const NVGpath *paths, int npaths) {
+		auto counts = (CountingRenderer *) uptr;
+		counts->strokes++;
+		counts->paths += npaths;
+		for (auto i = 0; i < npaths; i++)
+			counts->vertices += paths[i].nstroke;
+		counts->state(paint, composite, scissor, strokeWidth);
+	}
+
+	static void drawTriangles(void *uptr, NVGpaint *paint, NVGcompositeOperationState composite, NVGscissor *scissor,
+						  const NVGvertex *, int nverts, float) {
+		auto counts = (CountingRenderer *) uptr;
+		counts->triangles++;
+		counts->vertices += nverts;
+		counts->state(paint, composite, scissor, 0.f);
+	}
+
+	static void destroy(void *) {}
+
+	NVGcontext *createContext() {
+		NVGparams params;
+		std::memset(&params, 0, sizeof(params));
+		params.userPtr = this;
+		params.edgeAntiAlias = 1;
+		params.renderCreate = create;
+		params.renderCreateTexture = createTexture;
+		params.renderDeleteTexture = deleteTexture;
+		params.renderUpdateTexture = updateTexture;
+		params.renderGetTextureSize = getTextureSize;
+		params.renderViewport = viewport;
+		params.renderCancel = cancel;
+		params.renderFlush = flush;
+		params.renderFill = drawFill;
+		params.renderStroke = drawStroke;
+		params.renderTriangles = drawTriangles;
+		params.renderDelete = destroy;
+		return nvgCreateInternal(&params);
+	}
+};
+
+struct Case {
+	int bufferSize;
+	int channels;
+	int plotType;
+	int lineType;
+	bool fade;
+	int mirrors;
+};
+
+const char *plotNames[] = {"Normal", "Lissajous", "Kaleidoscope", "Spectrum"};
+const char *lineNames[] = {"Normal", "Vector", "Experimental"};
+
+/// capture a few sweeps of polyphonic sines, as they would come from the engine
+void capture(Scope &module, const Case &c) {
+	module.bufferSize = c.bufferSize;
+	module.params[Scope::PLOT_TYPE_PARAM].setValue(c.plotType);
+	module.params[Scope::LINE_TYPE_PARAM].setValue(c.lineType);
+	module.params[Scope::LINE_FADE_PARAM].setValue(c.fade);
+	module.params[Scope::KALEIDOSCOPE_COUNT_PARAM].setValue(c.mirrors);
+	module.params[Scope::KALEIDOSCOPE_RADIUS_PARAM].setValue(40.f);
+	// the shortest time base, a sample per point
+	module.params[Scope::TIME_PARAM].setValue(16.f);
+	module.inputs[Scope::X_INPUT].setChannels(c.channels);
+	module.inputs[Scope::Y_INPUT].setChannels(c.channels);
+
+	Module::ProcessArgs args;
+	args.sampleRate = 48000.f;
+	args.sampleTime = 1.f / args.sampleRate;
+	auto phase = 0.f;
+	for (auto i = 0; i < 8 * c.bufferSize; i++) {
+		phase += 220.f * args.sampleTime;
+		for (auto ch = 0; ch < c.channels; ch++) {
+			module.inputs[Scope::X_INPUT].setVoltage(5.f * std::sin(2.f * M_PI * phase * (1 + ch)), ch);
+			module.inputs[Scope::Y_INPUT].setVoltage(5.f * std::cos(2.f * M_PI * phase * 1.5f * (1 + ch)), ch);
+		}
+		module.process(args);
+		// stands in for the UI thread, which refills the pool every frame
+		if (i % 64 == 0)
+			gSamplePool.refill();
+	}
+}
+
+/// slow the time base down by 2x over a full ring, which re-lays it half filled, and check that the display
+/// makes points for the filled samples and not for the cleared half
+bool checkRezoom() {
+	Scope module;
+	module.bufferSize = 512;
+	module.params[Scope::TIME_PARAM].setValue(16.f);
+	module.inputs[Scope::X_INPUT].setChannels(1);
+	Module::ProcessArgs args;
+	args.sampleRate = 48000.f;
+	args.sampleTime = 1.f / args.sampleRate;
+	for (auto i = 0; i < 3 * module.bufferSize; i++) {
+		module.inputs[Scope::X_INPUT].setVoltage(5.f + std::sin(i * 0.1f));
+		module.process(args);
+	}
+	// 2^-14 s is 3 samples at 48 kHz, against 1 at 2^-16
+	module.params[Scope::TIME_PARAM].setValue(14.f);
+	module.controlDivider.reset();
+	module.process(args);
+
+	ScopeDisplay display;
+	display.module = &module;
+	display.snapshot = &module.snapshots.read();
+	auto &snapshot = *display.snapshot;
+	auto ok = true;
+	auto fail = [&](const char *what, int got, int expected) {
+		std::fprintf(stderr, "re-zoom check: %s is %d, expected %d\n", what, got, expected);
+		ok = false;
+	};
+	if (snapshot.filled != snapshot.bufferSize / 2 - 1)
+		fail("filled samples", snapshot.filled, snapshot.bufferSize / 2 - 1);
+
+	// a sample per point
+	display.pixelScale = 1.f;
+	auto wide = Rect(0, 0, 2 * snapshot.bufferSize, 100);
+	display.transformTimeTrace(snapshot.traceX, 0, 0.f, 0.2f, wide);
+	if (display.vertexCount != snapshot.filled)
+		fail("point count", display.vertexCount, snapshot.filled);
+	// none of the points come from the cleared half, which would be drawn as 0V
+	auto zeroY = wide.size.y - 15;
+	for (auto i = 0; i < display.vertexCount; i++) {
+		if (display.vertexY[i] >= zeroY - 0.1f) {
+			fail("point at 0V", i, -1);
+			break;
+		}
+	}
+
+	// two points per bin of 4 samples
+	auto narrow = Rect(0, 0, snapshot.bufferSize / 4, 100);
+	display.transformTimeTrace(snapshot.traceX, 0, 0.f, 0.2f, narrow);
+	if (display.vertexCount != 2 * (snapshot.filled / 4))
+		fail("reduced point count", display.vertexCount, 2 * (snapshot.filled / 4));
+	return ok;
+}
+
+void run(const Case &c, int frames, const std::shared_ptr<Font> &font, NVGcontext *vg, CountingRenderer &counts) {
+	Scope module;
+	capture(module, c);
+
+	ScopeDisplay display;
+	display.module = &module;
+	display.font = font;
+	display.box = Rect(0, 0, RACK_GRID_WIDTH * 17, RACK_GRID_HEIGHT);
+	Widget::DrawArgs args;
+	args.vg = vg;
+
+	// one frame untimed, to settle allocations
+	nvgBeginFrame(vg, display.box.size.x, display.box.size.y, 1.f);
+	display.preDrawWaveforms(args, display.box);
+	nvgEndFrame(vg);
+	counts.reset();
+
+	auto start = std::chrono::steady_clock::now();
+	for (auto f = 0; f < frames; f++) {
+		nvgBeginFrame(vg, display.box.size.x, display.box.size.y, 1.f);
+		display.preDrawWaveforms(args, display.box);
+		nvgEndFrame(vg);
+	}
+	auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	std::printf("%5d %3d %-12s %-12s %-4s %3d %10.3f %8.1f %8.1f %8.1f %10.1f %8.1f\n",
+				c.bufferSize, c.channels, plotNames[c.plotType], lineNames[c.lineType], c.fade ? "on" : "off",
+				c.mirrors, elapsed / frames, (double) counts.strokes / frames, (double) counts.fills / frames,
+				(double) counts.paths / frames, (double) counts.vertices / frames,
+				(double) counts.stateChanges / frames);
+	std::fflush(stdout);
+}
+
+}
+
+int main(int argc, char **argv) {
+	auto frames = argc > 1 ? std::max(std::atoi(argv[1]), 1) : 50;
+
+	// the display only needs the context to tell that there is no window
+	contextSet(new Context());
+
+	CountingRenderer counts;
+	auto vg = counts.createContext();
+	auto font = std::make_shared<Font>();
+	font->loadFile(BENCH_FONT, vg);
+
+	if (!checkRezoom())
+		return 1;
+
+	std::printf("%5s %3s %-12s %-12s %-4s %3s %10s %8s %8s %8s %10s %8s\n",
+				"size", "ch", "plot", "line", "fade", "mir", "ms/frame", "strokes", "fills", "paths", "vertices",
+				"states");
+	for (auto bufferSize : {512, 1024, 2048, 4096}) {
+		for (auto channels : {1, 4, 16}) {
+			for (auto plotType : {Scope::NORMAL, Scope::LISSAJOUS, Scope::KALEIDOSCOPE}) {
+				for (auto lineType = 0; lineType < Scope::NUM_LINES; lineType++) {
+					for (auto fade : {false, true}) {
+						for (auto mirrors : {3, 6, 12}) {
+							// mirrors only matter to the kaleidoscope
+							if (plotType != Scope::KALEIDOSCOPE && mirrors != 3)
+								continue;
+							run(Case{bufferSize, channels, plotType, lineType, fade, mirrors}, frames, font, vg,
+								counts);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	nvgDeleteInternal(vg);
+	return 0;
+}
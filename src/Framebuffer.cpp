@@ -0,0 +1,37 @@
+#include "Framebuffer.hpp"
+
+MFFramebuffer::~MFFramebuffer() {
+	release();
+}
+
+bool MFFramebuffer::reserve(NVGcontext *vg, int width, int height) {
+	if (fb && vg == this->vg && width == this->width && height == this->height)
+		return false;
+	release();
+	fb = nvgluCreateFramebuffer(vg, width, height, 0);
+	this->vg = vg;
+	this->width = width;
+	this->height = height;
+	return fb != nullptr;
+}
+
+void MFFramebuffer::release() {
+	if (fb)
+		nvgluDeleteFramebuffer(fb);
+	fb = nullptr;
+}
+
+void MFFramebuffer::begin(Vec size, float pixelRatio, bool clear) {
+	nvgluBindFramebuffer(fb);
+	glViewport(0, 0, width, height);
+	if (clear) {
+		glClearColor(0, 0, 0, 0);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+	nvgBeginFrame(vg, size.x, size.y, pixelRatio);
+}
+
+void MFFramebuffer::end() {
+	nvgEndFrame(vg);
+	nvgluBindFramebuffer(NULL);
+}
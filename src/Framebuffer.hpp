@@ -0,0 +1,28 @@
+#pragma once
+
+#include "rack.hpp"
+
+using namespace rack;
+
+// An offscreen framebuffer drawn with nanovg, recreated when its size changes.
+// Framebuffers belong to the nanovg context that made them, so a second window needs its own.
+struct MFFramebuffer {
+	NVGcontext *vg = nullptr;
+	NVGLUframebuffer *fb = nullptr;
+	int width = 0;
+	int height = 0;
+
+	MFFramebuffer() = default;
+	MFFramebuffer(const MFFramebuffer &) = delete;
+	MFFramebuffer &operator=(const MFFramebuffer &) = delete;
+	~MFFramebuffer();
+
+	// make sure there is a framebuffer of the given pixel size in vg.
+	// Returns true if it was created, its contents are undefined then
+	bool reserve(NVGcontext *vg, int width, int height);
+	// needs the GL context of vg to be current
+	void release();
+	// bind the framebuffer and start a nanovg frame on it, size is in widget units
+	void begin(Vec size, float pixelRatio, bool clear);
+	void end();
+};
@@ -32,6 +32,7 @@
 
 
 #include "ModularFungi.hpp"
+#include "Framebuffer.hpp"
 
 
 struct LightsOffModule : Module {
@@ -65,54 +66,468 @@ struct LightsOffModule : Module {
 static LightsOffModule *lightsOffSingleton = NULL;
 
 
+// Uniform grid over boxes in rack coordinates, so a viewport only visits the boxes in the cells it overlaps.
+// Boxes are filed under the cell of their top left corner, in one flat array ordered by cell.
+struct LightsOffGrid {
+	static const int MAX_CELLS = 1 << 16;
+	float cellSize = RACK_GRID_HEIGHT / 2.f;
+	Vec origin;
+	int columns = 0;
+	int rows = 0;
+	// the largest box, queries are widened by it to catch boxes reaching in from the cells to the left and above
+	Vec maxSize;
+	// items of cell c are items[cellStart[c]] up to items[cellStart[c + 1]]
+	std::vector<int> cellStart;
+	std::vector<int> items;
+
+	size_t capacity() const {
+		return cellStart.capacity() + items.capacity();
+	}
+
+	template <typename F>
+	void build(int count, F boxOf) {
+		columns = rows = 0;
+		items.resize(count);
+		if (count == 0)
+			return;
+
+		Vec lo = boxOf(0).pos;
+		Vec hi = lo;
+		maxSize = Vec();
+		for (int i = 0; i < count; i++) {
+			Rect r = boxOf(i);
+			lo = lo.min(r.pos);
+			hi = hi.max(r.pos);
+			maxSize = maxSize.max(r.size);
+		}
+		origin = lo;
+		// half a rack row, coarser for modules scattered far apart
+		cellSize = RACK_GRID_HEIGHT / 2.f;
+		while (((hi.x - lo.x) / cellSize + 1) * ((hi.y - lo.y) / cellSize + 1) > MAX_CELLS)
+			cellSize *= 2.f;
+		columns = (int) ((hi.x - lo.x) / cellSize) + 1;
+		rows = (int) ((hi.y - lo.y) / cellSize) + 1;
+
+		// counting sort by cell
+		cellStart.assign(columns * rows + 1, 0);
+		for (int i = 0; i < count; i++)
+			cellStart[cellOf(boxOf(i).pos) + 1]++;
+		for (int c = 0; c < columns * rows; c++)
+			cellStart[c + 1] += cellStart[c];
+		for (int i = 0; i < count; i++)
+			items[cellStart[cellOf(boxOf(i).pos)]++] = i;
+		// filling moved each start to the next cell's, move them back
+		for (int c = columns * rows; c > 0; c--)
+			cellStart[c] = cellStart[c - 1];
+		cellStart[0] = 0;
+	}
+
+	int cellOf(Vec p) const {
+		int column = (int) ((p.x - origin.x) / cellSize);
+		int row = (int) ((p.y - origin.y) / cellSize);
+		return row * columns + column;
+	}
+
+	/// call f with the index of every item in a cell that r overlaps
+	template <typename F>
+	void visit(Rect r, F f) const {
+		if (columns == 0)
+			return;
+		int column0 = std::max((int) std::floor((r.pos.x - maxSize.x - origin.x) / cellSize), 0);
+		int row0 = std::max((int) std::floor((r.pos.y - maxSize.y - origin.y) / cellSize), 0);
+		int column1 = std::min((int) std::floor((r.pos.x + r.size.x - origin.x) / cellSize), columns - 1);
+		int row1 = std::min((int) std::floor((r.pos.y + r.size.y - origin.y) / cellSize), rows - 1);
+		for (int row = row0; row <= row1; row++) {
+			for (int column = column0; column <= column1; column++) {
+				int c = row * columns + column;
+				for (int i = cellStart[c]; i < cellStart[c + 1]; i++)
+					f(items[i]);
+			}
+		}
+	}
+};
+
+
 struct LightsOffContainer : widget::Widget {
 	LightsOffModule *module;
 
-	void draw(const DrawArgs& args) override {
+	// A module as it was when the lights were found, a change to any of them means the lights have to be found again.
+	// Engine ids are never reused, so a widget allocated where a deleted one was is still told apart.
+	// A module that adds, removes or rebuilds its children changes their count or addresses, and its lights are
+	// found again rather than left pointing at deleted widgets. Only the module's own children are checked,
+	// a light nested in another child is caught when that child is replaced
+	struct ModuleKey {
+		Widget *widget;
+		int id;
+		Rect box;
+		size_t childCount;
+		uintptr_t childHash;
+
+		bool operator==(const ModuleKey &other) const {
+			return widget == other.widget && id == other.id && box.pos.x == other.box.pos.x
+				   && box.pos.y == other.box.pos.y && box.size.x == other.box.size.x && box.size.y == other.box.size.y
+				   && childCount == other.childCount && childHash == other.childHash;
+		}
+	};
+
+	struct LightEntry {
+		LightWidget *light;
+		// position in rack coordinates
+		Vec pos;
+	};
+
+	// A cable as it was when its plug positions were taken. A cable dragged from one port to another
+	// can keep its widget, so its ports are kept to tell
+	struct CableEntry {
+		CableWidget *cable;
+		PortWidget *outputPort;
+		PortWidget *inputPort;
+		// plug positions in rack coordinates
+		Vec outputPos;
+		Vec inputPos;
+	};
+
+	std::vector<ModuleKey> modules;
+	std::vector<ModuleKey> currentModules;
+	// lights whose color follows their module's lights, these are cached in the overlay
+	std::vector<LightEntry> lights;
+	// Lights that draw something of their own, like the scope's display, or have no module lights to follow.
+	// Their color says nothing about what they show, so they are drawn live on top of the overlay every frame
+	std::vector<LightEntry> liveLights;
+	LightsOffGrid lightGrid;
+	// the cable container's children when the cables were last taken
+	std::vector<Widget*> cables;
+	// complete cables, their plugs are filed in plugGrid as 2 * index and 2 * index + 1
+	std::vector<CableEntry> cableEntries;
+	// cables being dragged follow the mouse and are always drawn
+	std::vector<CableEntry> looseCables;
+	LightsOffGrid plugGrid;
+	// lightGeneration when the cables were last taken, their plugs move with the modules
+	int cableGeneration = -1;
+	// set by step once the lights and cables are up to date, draw only refreshes them if it is not
+	bool refreshed = false;
+	// indices of the cables with a plug in the viewport, and the frame each cable was last added in
+	std::vector<int> visibleCables;
+	std::vector<int> cableFrame;
+	int frame = 0;
+	// widgets still to visit when looking for lights, kept between walks so its storage is reused
+	std::vector<Widget*> stack;
+	// Diagnostic shown in the menu: the number of frames in which the total capacity of the vectors above changed.
+	// Vectors keep their storage when cleared, so it stops counting once the patch stops changing shape.
+	// It is not an allocation count: nanovg, the overlay framebuffer and everything else that allocates go unseen
+	int capacityChanges = 0;
+	size_t lastCapacity = 0;
+	// bumped whenever the lights are found again
+	int lightGeneration = 0;
+
+	// The dim layer and the visible lights, drawn offscreen in step and blitted by draw while nothing has changed.
+	// It covers the viewport only, at the resolution the rack is drawn with
+	MFFramebuffer overlay;
+	bool overlayValid = false;
+	Rect overlayViewPort;
+	float overlayScale = 0.f;
+	float overlayDim = 0.f;
+	int overlayGeneration = -1;
+	// colors of the visible lights when the overlay was drawn, in the order the grid visits them
+	std::vector<NVGcolor> overlayColors;
+	// set by draw, the overlay is only worth rendering while the container is being drawn
+	bool drawn = false;
+	float drawScale = 1.f;
+
+	~LightsOffContainer() {
+		overlay.release();
+	}
+
+	void countCapacityChange() {
+		size_t capacity = modules.capacity() + currentModules.capacity() + lights.capacity() + stack.capacity()
+						  + liveLights.capacity() + lightGrid.capacity() + overlayColors.capacity() + cables.capacity()
+						  + cableEntries.capacity() + looseCables.capacity()
+						  + plugGrid.capacity() + visibleCables.capacity() + cableFrame.capacity();
+		if (capacity != lastCapacity) {
+			capacityChanges++;
+			lastCapacity = capacity;
+		}
+	}
+
+	/// find every light in the rack again if a module has been added, removed, moved or resized, or has changed its
+	/// children, since the last time
+	void refreshLights() {
+		Widget *moduleContainer = APP->scene->rack->moduleContainer;
+		currentModules.clear();
+		for (Widget *w : moduleContainer->children) {
+			ModuleWidget *mw = dynamic_cast<ModuleWidget*>(w);
+			uintptr_t childHash = 0;
+			for (Widget *child : w->children) {
+				// order matters too, so the same children in another order hash differently
+				childHash = childHash * 31 + (uintptr_t) child;
+			}
+			currentModules.push_back(ModuleKey{w, mw && mw->module ? mw->module->id : -1, w->box,
+											   w->children.size(), childHash});
+		}
+		if (currentModules == modules) {
+			countCapacityChange();
+			return;
+		}
+		modules.swap(currentModules);
+		lightGeneration++;
+
+		// depth first, children are pushed last to first so they are visited in order
+		lights.clear();
+		liveLights.clear();
+		stack.clear();
+		stack.push_back(moduleContainer);
+		while (!stack.empty()) {
+			Widget* w = stack.back();
+			stack.pop_back();
+
+			LightWidget *lw = dynamic_cast<LightWidget*>(w);
+			if (lw) {
+				// the container sits at the rack's origin, so this is also its own coordinate space
+				LightEntry entry{lw, lw->getRelativeOffset(Vec(), APP->scene->rack)};
+				ModuleLightWidget *mlw = dynamic_cast<ModuleLightWidget*>(lw);
+				if (mlw && !mlw->baseColors.empty())
+					lights.push_back(entry);
+				else
+					liveLights.push_back(entry);
+			}
+
+			for (auto it = w->children.rbegin(); it != w->children.rend(); ++it) {
+				stack.push_back(*it);
+			}
+		}
+		lightGrid.build((int) lights.size(), [this](int i) {
+			return Rect(lights[i].pos, lights[i].light->box.size);
+		});
+		countCapacityChange();
+	}
+
+	/// true if a cable has been added, removed or replugged since the plug positions were taken
+	bool cablesChanged() {
+		const auto &children = APP->scene->rack->cableContainer->children;
+		if (children.size() != cables.size())
+			return true;
+		auto it = cables.begin();
+		for (Widget *w : children) {
+			if (w != *it++)
+				return true;
+		}
+		// the cached widgets are still children, so they are still alive
+		for (const std::vector<CableEntry> *entries : {&cableEntries, &looseCables}) {
+			for (const CableEntry &entry : *entries) {
+				if (entry.cable->outputPort != entry.outputPort || entry.cable->inputPort != entry.inputPort)
+					return true;
+			}
+		}
+		return false;
+	}
+
+	/// take the plug positions again if a cable has been added, removed or replugged, or a module has moved
+	void refreshCables() {
+		if (cableGeneration == lightGeneration && !cablesChanged()) {
+			countCapacityChange();
+			return;
+		}
+		cableGeneration = lightGeneration;
+
+		Widget *cableContainer = APP->scene->rack->cableContainer;
+		cables.clear();
+		cableEntries.clear();
+		looseCables.clear();
+		for (Widget *w : cableContainer->children) {
+			cables.push_back(w);
+			CableWidget *cw = dynamic_cast<CableWidget*>(w);
+			if (!cw)
+				continue;
+			if (cw->isComplete())
+				cableEntries.push_back(
+					CableEntry{cw, cw->outputPort, cw->inputPort, cw->getOutputPos(), cw->getInputPos()});
+			else
+				looseCables.push_back(CableEntry{cw, cw->outputPort, cw->inputPort, Vec(), Vec()});
+		}
+		// a plug is drawn a little larger than its port
+		const float plugRadius = 12.f;
+		plugGrid.build((int) cableEntries.size() * 2, [this, plugRadius](int i) {
+			const CableEntry &entry = cableEntries[i / 2];
+			Vec pos = (i % 2) ? entry.inputPos : entry.outputPos;
+			return Rect(pos.minus(Vec(plugRadius, plugRadius)), Vec(2 * plugRadius, 2 * plugRadius));
+		});
+		cableFrame.assign(cableEntries.size(), -1);
+		countCapacityChange();
+	}
+
+	/// draw the plugs of the cables with either end in viewPort, in the order Rack draws its cables.
+	/// This culls, it doesn't batch: each visible cable still draws its own plugs and plug lights. Rack keeps the
+	/// plug drawing in a function private to CableWidget.cpp, and the plug light type is only declared to plugins
+	void drawPlugs(const DrawArgs& args, Rect viewPort) {
+		frame++;
+		visibleCables.clear();
+		plugGrid.visit(viewPort, [&](int i) {
+			int cable = i / 2;
+			if (cableFrame[cable] != frame) {
+				cableFrame[cable] = frame;
+				visibleCables.push_back(cable);
+			}
+		});
+		std::sort(visibleCables.begin(), visibleCables.end());
+		for (int cable : visibleCables) {
+			cableEntries[cable].cable->drawPlugs(args);
+		}
+		for (const CableEntry &entry : looseCables) {
+			entry.cable->drawPlugs(args);
+		}
+	}
+
+	float getDim() {
+		return module->params[LightsOffModule::PARAM_DIM].getValue();
+	}
+
+	/// the dim layer and the lights inside viewPort
+	void drawOverlay(const DrawArgs& args, Rect viewPort) {
+		// Dim layer
+		nvgBeginPath(args.vg);
+		nvgRect(args.vg, viewPort.pos.x, viewPort.pos.y, viewPort.size.x, viewPort.size.y);
+		nvgFillColor(args.vg, nvgRGBA(0x00, 0x00, 0x00, (char)(255.f * getDim())));
+		nvgFill(args.vg);
+
+		// Draw lights
+		lightGrid.visit(viewPort, [&](int i) {
+			drawLight(args, viewPort, lights[i]);
+		});
+	}
+
+	void drawLight(const DrawArgs& args, Rect viewPort, const LightEntry &entry) {
+		LightWidget *lw = entry.light;
+		// Draw only if currently visible
+		if (viewPort.isIntersecting(Rect(entry.pos, lw->box.size))) {
+			nvgSave(args.vg);
+			nvgResetScissor(args.vg);
+			nvgTranslate(args.vg, entry.pos.x, entry.pos.y);
+			lw->draw(args);
+			nvgRestore(args.vg);
+		}
+	}
+
+	/// true if any visible light changed color by more than a couple of 8 bit steps since the overlay was drawn
+	bool lightsChanged(Rect viewPort) {
+		const float threshold = 2.f / 255.f;
+		size_t k = 0;
+		bool changed = false;
+		lightGrid.visit(viewPort, [&](int i) {
+			const LightEntry &entry = lights[i];
+			if (changed || !viewPort.isIntersecting(Rect(entry.pos, entry.light->box.size)))
+				return;
+			if (k >= overlayColors.size()) {
+				changed = true;
+				return;
+			}
+			const NVGcolor &a = entry.light->color;
+			const NVGcolor &b = overlayColors[k++];
+			for (int c = 0; c < 4; c++) {
+				if (std::fabs(a.rgba[c] - b.rgba[c]) > threshold)
+					changed = true;
+			}
+		});
+		return changed || k != overlayColors.size();
+	}
+
+	/// draw the overlay into its framebuffer again if the view, the dim amount or a light has changed
+	void renderOverlay() {
+		int winWidth, winHeight;
+		int fbWidth, fbHeight;
+		glfwGetWindowSize(APP->window->win, &winWidth, &winHeight);
+		glfwGetFramebufferSize(APP->window->win, &fbWidth, &fbHeight);
+		float scale = drawScale * (winWidth > 0 ? (float) fbWidth / (float) winWidth : 1.f);
+		Rect viewPort = getViewport(box);
+		float dim = getDim();
+
+		if (overlayValid && overlay.fb && overlayScale == scale && overlayDim == dim
+			&& overlayGeneration == lightGeneration && viewPort.pos.x == overlayViewPort.pos.x
+			&& viewPort.pos.y == overlayViewPort.pos.y && viewPort.size.x == overlayViewPort.size.x
+			&& viewPort.size.y == overlayViewPort.size.y && !lightsChanged(viewPort)) {
+			return;
+		}
+
+		int width = (int) std::ceil(viewPort.size.x * scale);
+		int height = (int) std::ceil(viewPort.size.y * scale);
+		overlayValid = false;
+		if (width <= 0 || height <= 0)
+			return;
+		overlay.reserve(APP->window->vg, width, height);
+		if (!overlay.fb)
+			return;
+
+		overlay.begin(viewPort.size, scale, true);
+		nvgTranslate(APP->window->vg, -viewPort.pos.x, -viewPort.pos.y);
+		DrawArgs args;
+		args.vg = APP->window->vg;
+		args.clipBox = viewPort;
+		drawOverlay(args, viewPort);
+		overlay.end();
+
+		overlayColors.clear();
+		lightGrid.visit(viewPort, [&](int i) {
+			const LightEntry &entry = lights[i];
+			if (viewPort.isIntersecting(Rect(entry.pos, entry.light->box.size)))
+				overlayColors.push_back(entry.light->color);
+		});
+		overlayValid = true;
+		overlayViewPort = viewPort;
+		overlayScale = scale;
+		overlayDim = dim;
+		overlayGeneration = lightGeneration;
+		countCapacityChange();
+	}
+
+	void step() override {
+		// offscreen rendering has to happen outside of the frame being drawn, like the scope's trace cache
 		if (module && module->isActive()) {
-			// Dim layer
 			box = parent->box.zeroPos();
-			nvgBeginPath(args.vg);
-			nvgRect(args.vg, 0, 0, box.size.x, box.size.y);
-			nvgFillColor(args.vg, nvgRGBA(0x00, 0x00, 0x00, (char)(255.f * module->params[LightsOffModule::PARAM_DIM].getValue())));
-			nvgFill(args.vg);
+			refreshLights();
+			refreshCables();
+			refreshed = true;
+			if (drawn)
+				renderOverlay();
+		} else {
+			overlay.release();
+			overlayValid = false;
+		}
+		drawn = false;
+		Widget::step();
+	}
+
+	void draw(const DrawArgs& args) override {
+		if (module && module->isActive()) {
+			float xform[6];
+			nvgCurrentTransform(args.vg, xform);
+			drawScale = std::hypot(xform[0], xform[1]);
+			drawn = true;
+			// step keeps the lights and cables up to date, unless it hasn't run since the last draw
+			if (!refreshed) {
+				refreshLights();
+				refreshCables();
+			}
+			refreshed = false;
 
-			// Draw lights
 			Rect viewPort = getViewport(box);
-			std::queue<Widget*> q;
-			q.push(APP->scene->rack->moduleContainer);
-			while (!q.empty()) {
-				Widget* w = q.front();
-				q.pop();
-
-				LightWidget *lw = dynamic_cast<LightWidget*>(w);
-				if (lw) {
-					Vec p1 = lw->getRelativeOffset(Vec(), this);
-					Vec p = getAbsoluteOffset(Vec()).neg();
-					p = p.plus(p1);
-					p = p.div(APP->scene->rackScroll->zoomWidget->zoom);
-
-					// Draw only if currently visible
-					if (viewPort.isIntersecting(Rect(p, lw->box.size))) {
-						nvgSave(args.vg);
-						nvgResetScissor(args.vg);
-						nvgTranslate(args.vg, p.x, p.y);
-						lw->draw(args);
-						nvgRestore(args.vg);
-					}
-				}
-
-				for (Widget *w1 : w->children) {
-					q.push(w1);
-				}
+			if (overlayValid && overlay.fb && viewPort.pos.x == overlayViewPort.pos.x
+				&& viewPort.pos.y == overlayViewPort.pos.y && viewPort.size.x == overlayViewPort.size.x
+				&& viewPort.size.y == overlayViewPort.size.y) {
+				NVGpaint paint = nvgImagePattern(args.vg, viewPort.pos.x, viewPort.pos.y, viewPort.size.x,
+												 viewPort.size.y, 0, overlay.fb->image, 1.f);
+				nvgBeginPath(args.vg);
+				nvgRect(args.vg, viewPort.pos.x, viewPort.pos.y, viewPort.size.x, viewPort.size.y);
+				nvgFillPaint(args.vg, paint);
+				nvgFill(args.vg);
+			} else {
+				// not rendered yet, or the view moved since step
+				drawOverlay(args, viewPort);
+			}
+			for (const LightEntry &entry : liveLights) {
+				drawLight(args, viewPort, entry);
 			}
 
 			// Draw cable plugs
-			for (widget::Widget *w : APP->scene->rack->cableContainer->children) {
-				CableWidget *cw = dynamic_cast<CableWidget*>(w);
-				assert(cw);
-				cw->drawPlugs(args);
-			}
+			drawPlugs(args, viewPort);
 		}
 		Widget::draw(args);
 	}
@@ -231,6 +646,12 @@ struct LightsOffWidget : ModuleWidget {
 		menu->addChild(construct<MenuLabel>(&MenuLabel::text, "Hotkey " RACK_MOD_CTRL_NAME "+Alt+X"));
 		menu->addChild(construct<ActiveItem>(&MenuItem::text, "Active", &ActiveItem::module, module));
 		menu->addChild(new DimSlider(module));
+
+		if (enabled && loContainer) {
+			menu->addChild(construct<MenuLabel>(&MenuLabel::text,
+				string::f("%d lights, %d vector capacity changes", (int) (loContainer->lights.size() + loContainer->liveLights.size()),
+						  loContainer->capacityChanges)));
+		}
 	}
 };
 
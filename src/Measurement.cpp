@@ -0,0 +1,186 @@
+#include "Measurement.hpp"
+
+MFMeasurement::MFMeasurement() {
+	thread = std::thread([this]() {
+		run();
+	});
+}
+
+MFMeasurement::~MFMeasurement() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = false;
+	}
+	condition.notify_one();
+	thread.join();
+}
+
+void MFMeasurement::submit(int signal, const float *ring, int start, int size, float samplePeriod) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		Job &job = jobs[signal];
+		job.samples.resize(size);
+		for (int i = 0; i < size; i++)
+			job.samples[i] = ring[(start + i) & (size - 1)];
+		job.samplePeriod = samplePeriod;
+		job.pending = true;
+	}
+	condition.notify_one();
+}
+
+MFMeasurement::Result MFMeasurement::result(int signal) {
+	std::lock_guard<std::mutex> lock(mutex);
+	return results[signal];
+}
+
+void MFMeasurement::run() {
+	std::vector<float> samples;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		condition.wait(lock, [this]() {
+			return !running || jobs[0].pending || jobs[1].pending;
+		});
+		if (!running)
+			return;
+		for (int signal = 0; signal < NUM_SIGNALS; signal++) {
+			Job &job = jobs[signal];
+			if (!job.pending)
+				continue;
+			job.pending = false;
+			samples.swap(job.samples);
+			float samplePeriod = job.samplePeriod;
+
+			lock.unlock();
+			Result result = measure(samples, samplePeriod);
+			lock.lock();
+			results[signal] = result;
+		}
+	}
+}
+
+MFMeasurement::Result MFMeasurement::measure(const std::vector<float> &samples, float samplePeriod) {
+	Result result;
+	int size = samples.size();
+	if (size < 4 || samplePeriod <= 0.f)
+		return result;
+
+	float vMin = INFINITY;
+	float vMax = -INFINITY;
+	float mean = 0.f;
+	for (float v : samples) {
+		vMin = std::fmin(vMin, v);
+		vMax = std::fmax(vMax, v);
+		mean += v;
+	}
+	mean /= size;
+	if (vMax - vMin < 1e-3f)
+		return result;
+
+	// Rising crossings of the mean, with hysteresis against noise. The crossing time is
+	// interpolated between the two samples either side of the mean
+	float hysteresis = 0.1f * (vMax - vMin);
+	bool high = samples[0] > mean;
+	float crossing = -1.f;
+	std::vector<float> crossings;
+	int above = 0;
+	for (int i = 1; i < size; i++) {
+		if (samples[i - 1] <= mean && samples[i] > mean)
+			crossing = i - 1 + (mean - samples[i - 1]) / (samples[i] - samples[i - 1]);
+		if (!high && samples[i] > mean + hysteresis && crossing >= 0.f) {
+			high = true;
+			crossings.push_back(crossing);
+		}
+		else if (high && samples[i] < mean - hysteresis) {
+			high = false;
+		}
+		if (samples[i] > mean)
+			above++;
+	}
+
+	// the zero crossing estimate is only trusted when the periods it finds agree
+	float period = 0.f;
+	int periods = (int) crossings.size() - 1;
+	if (periods >= 1) {
+		period = (crossings.back() - crossings.front()) / periods;
+		float deviation = 0.f;
+		for (int i = 0; i < periods; i++)
+			deviation = std::fmax(deviation, std::fabs(crossings[i + 1] - crossings[i] - period));
+		if (deviation > 0.2f * period)
+			period = 0.f;
+	}
+	if (period > 0.f) {
+		// duty is measured over whole periods only
+		int aboveInPeriods = 0;
+		for (int i = (int) std::ceil(crossings.front()); i <= (int) crossings.back(); i++) {
+			if (samples[i] > mean)
+				aboveInPeriods++;
+		}
+		result.duty = aboveInPeriods / (crossings.back() - crossings.front());
+	}
+	else {
+		period = autocorrelationPeriod(samples, mean);
+		result.duty = (float) above / (size - 1);
+	}
+
+	if (period <= 0.f)
+		return result;
+	result.valid = true;
+	result.period = period * samplePeriod;
+	result.frequency = 1.f / result.period;
+	return result;
+}
+
+/// Period in samples from the first peak of the autocorrelation, computed with an FFT.
+/// Used when the waveform crosses its mean more than once per period or too rarely. Returns 0 if none is found
+float MFMeasurement::autocorrelationPeriod(const std::vector<float> &samples, float mean) {
+	int size = samples.size();
+	// zero padded to twice the length, so the correlation doesn't wrap around
+	int length = 32;
+	while (length < 2 * size)
+		length *= 2;
+	if (length != fftSize) {
+		fft.reset(new dsp::RealFFT(length));
+		fftSize = length;
+		fftBuffer.resize(length);
+		spectrum.resize(length);
+	}
+	for (int i = 0; i < length; i++)
+		fftBuffer[i] = i < size ? samples[i] - mean : 0.f;
+
+	// power spectrum, in the ordering RealFFT::rfft uses, transformed back is the autocorrelation
+	fft->rfft(fftBuffer.data(), spectrum.data());
+	spectrum[0] *= spectrum[0];
+	spectrum[1] *= spectrum[1];
+	for (int k = 2; k < length; k += 2) {
+		spectrum[k] = spectrum[k] * spectrum[k] + spectrum[k + 1] * spectrum[k + 1];
+		spectrum[k + 1] = 0.f;
+	}
+	fft->irfft(spectrum.data(), fftBuffer.data());
+	if (fftBuffer[0] <= 0.f)
+		return 0.f;
+
+	// skip the central lobe, then take the highest peak, preferring earlier ones so a multiple of the
+	// period isn't picked. Each lag is normalised by the number of samples overlapping at that lag
+	int lag = 1;
+	while (lag < size / 2 && fftBuffer[lag] > 0.f)
+		lag++;
+	int best = 0;
+	float bestValue = 0.3f;
+	for (int i = lag; i < size / 2; i++) {
+		float value = fftBuffer[i] / fftBuffer[0] * size / (size - i);
+		if (value > bestValue * 1.1f) {
+			best = i;
+			bestValue = value;
+		}
+	}
+	if (best == 0)
+		return 0.f;
+
+	// parabolic interpolation around the peak
+	float a = fftBuffer[best - 1];
+	float b = fftBuffer[best];
+	float c = fftBuffer[best + 1];
+	float denominator = a - 2.f * b + c;
+	float offset = denominator != 0.f ? 0.5f * (a - c) / denominator : 0.f;
+	return best + clamp(offset, -0.5f, 0.5f);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "rack.hpp"
+
+using namespace rack;
+
+// Frequency, period and duty cycle of scope sweeps, measured on a worker thread
+// so neither the audio nor the UI thread pays for it.
+// Sweeps are handed over with submit, which copies the samples and returns straight away.
+struct MFMeasurement {
+	static const int NUM_SIGNALS = 2;
+
+	struct Result {
+		bool valid = false;
+		float frequency = 0.f;
+		float period = 0.f;
+		float duty = 0.f;
+	};
+
+	MFMeasurement();
+	~MFMeasurement();
+	// copy size samples from a ring, starting at start, to be measured as signal.
+	// Replaces any sweep of the same signal that is still waiting
+	void submit(int signal, const float *ring, int start, int size, float samplePeriod);
+	Result result(int signal);
+
+private:
+	struct Job {
+		std::vector<float> samples;
+		float samplePeriod = 0.f;
+		bool pending = false;
+	};
+
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::thread thread;
+	bool running = true;
+	Job jobs[NUM_SIGNALS];
+	Result results[NUM_SIGNALS];
+	// owned by the worker
+	std::unique_ptr<dsp::RealFFT> fft;
+	int fftSize = 0;
+	std::vector<float> fftBuffer;
+	std::vector<float> spectrum;
+
+	void run();
+	Result measure(const std::vector<float> &samples, float samplePeriod);
+	float autocorrelationPeriod(const std::vector<float> &samples, float mean);
+};
@@ -0,0 +1,115 @@
+#include <cstring>
+#include "SamplePool.hpp"
+
+static int sizeClassOf(int size) {
+	assert(size >= 2 && isPow2(size));
+	int sizeClass = 0;
+	while ((1 << sizeClass) < size)
+		sizeClass++;
+	return sizeClass;
+}
+
+// the free lists keep the next block in the first bytes of each one
+static float *nextOf(float *block) {
+	float *next;
+	std::memcpy(&next, block, sizeof(next));
+	return next;
+}
+
+static void setNext(float *block, float *next) {
+	std::memcpy(block, &next, sizeof(next));
+}
+
+MFSamplePool::MFSamplePool() {
+	for (auto &blocks : freeBlocks)
+		blocks.store(nullptr);
+}
+
+MFSamplePool::~MFSamplePool() {
+	for (auto &blocks : freeBlocks) {
+		float *block = blocks.exchange(nullptr);
+		while (block) {
+			float *next = nextOf(block);
+			delete[] block;
+			block = next;
+		}
+	}
+}
+
+void MFSamplePool::push(int sizeClass, float *block) {
+	float *head = freeBlocks[sizeClass].load();
+	do {
+		setNext(block, head);
+	} while (!freeBlocks[sizeClass].compare_exchange_weak(head, block));
+}
+
+float *MFSamplePool::acquire(int size) {
+	int sizeClass = sizeClassOf(size);
+	// Taking the whole list with one exchange and putting the rest back avoids the ABA problem of popping
+	// a single block with compare and swap. Another thread may briefly see the list empty, that only
+	// costs an extra refill
+	float *block = freeBlocks[sizeClass].exchange(nullptr);
+	if (!block) {
+		starved.fetch_or(1u << sizeClass);
+		return nullptr;
+	}
+	float *rest = freeBlocks[sizeClass].exchange(nextOf(block));
+	// blocks released while the list was taken
+	while (rest) {
+		float *next = nextOf(rest);
+		push(sizeClass, rest);
+		rest = next;
+	}
+	return block;
+}
+
+void MFSamplePool::release(float *block, int size) {
+	if (!block)
+		return;
+	push(sizeClassOf(size), block);
+}
+
+void MFSamplePool::prefill(int size, int count) {
+	int sizeClass = sizeClassOf(size);
+	for (int i = 0; i < count; i++)
+		push(sizeClass, new float[size]);
+}
+
+void MFSamplePool::refill() {
+	uint32_t sizes = starved.exchange(0);
+	for (int sizeClass = 0; sizes; sizeClass++, sizes >>= 1) {
+		if (!(sizes & 1))
+			continue;
+		for (int i = 0; i < REFILL_BLOCKS; i++)
+			push(sizeClass, new float[1 << sizeClass]);
+	}
+	if (++refills >= TRIM_INTERVAL) {
+		refills = 0;
+		trim();
+	}
+}
+
+void MFSamplePool::trim() {
+	for (int sizeClass = 0; sizeClass < NUM_SIZES; sizeClass++) {
+		// taken whole as in acquire, which may briefly see the list empty
+		float *block = freeBlocks[sizeClass].exchange(nullptr);
+		float *kept = nullptr;
+		for (int i = 0; block; i++) {
+			float *next = nextOf(block);
+			if (i < REFILL_BLOCKS) {
+				setNext(block, kept);
+				kept = block;
+			} else {
+				delete[] block;
+			}
+			block = next;
+		}
+		while (kept) {
+			float *next = nextOf(kept);
+			push(sizeClass, kept);
+			kept = next;
+		}
+	}
+}
+
+MFSamplePool gSamplePool;
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include "rack.hpp"
+
+using namespace rack;
+
+// Blocks of sample memory shared by every scope in the plugin.
+// Released blocks are kept for reuse, so resizing or changing channel count swaps blocks instead of
+// reallocating. Every TRIM_INTERVAL refills the free blocks of each size beyond REFILL_BLOCKS are freed.
+// acquire and release are lock-free and never allocate, so the audio thread can use them.
+// When a size runs out acquire returns nullptr, and the next refill on the UI thread adds more.
+// Modules prefill what they expect to need, so they can capture before the UI runs, or without one.
+struct MFSamplePool {
+	// one free list per power of two size, linked through the first bytes of each block
+	static const int NUM_SIZES = 32;
+	// blocks added by refill each time a size has run out, and kept free by trim
+	static const int REFILL_BLOCKS = 64;
+	// refills between trims, a few seconds at the UI frame rate
+	static const int TRIM_INTERVAL = 256;
+
+	std::atomic<float *> freeBlocks[NUM_SIZES];
+	// bit n is set when a block of size 2^n was asked for and none was free
+	std::atomic<uint32_t> starved{0};
+
+	MFSamplePool();
+	~MFSamplePool();
+	// size must be a power of two
+	float *acquire(int size);
+	void release(float *block, int size);
+	// add count new blocks of size, not from the audio thread
+	void prefill(int size, int count);
+	// allocate blocks for the sizes that ran out since the last call, and trim now and then. UI thread only
+	void refill();
+
+private:
+	int refills = 0;
+
+	void push(int sizeClass, float *block);
+	void trim();
+};
+
+extern MFSamplePool gSamplePool;
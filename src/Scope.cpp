@@ -24,10 +24,19 @@
 
 //Popout window code by Richie Hindle
 
+#include <array>
 #include <cstring>
 #include <memory>
 #include <atomic>
+#include <thread>
+#include <chrono>
+#include <mutex>
 #include "ModularFungi.hpp"
+#include "SamplePool.hpp"
+#include "Measurement.hpp"
+#include "Spectrum.hpp"
+#include "TraceRenderer.hpp"
+#include "Framebuffer.hpp"
 
 // Get the GLFW API.
 #define GLEW_STATIC
@@ -42,6 +51,381 @@
 // in the context menu
 static const auto MAX_BUFFER_SIZE = 4096;
 
+/// Lock-free triple buffer for handing data from the audio thread to the UI thread.
+/// The writer owns one slot, the reader owns another and the third sits in the middle.
+/// Publishing and acquiring are a single atomic exchange each, so neither side ever waits,
+/// and the reader's slot is never touched by the writer until the reader gives it back.
+template<typename T>
+struct TripleBuffer {
+	T slots[3] = {};
+
+	/// publish the writer's slot, returning the index of the slot just published
+	int publish() {
+		auto published = back;
+		back = middle.exchange(back | FRESH) & INDEX_MASK;
+		return published;
+	}
+
+	/// slot owned by the writer
+	T &writeSlot() {
+		return slots[back];
+	}
+
+	/// latest published slot, valid until the next call to read()
+	const T &read() {
+		if (middle.load() & FRESH)
+			front = middle.exchange(front) & INDEX_MASK;
+		return slots[front];
+	}
+
+private:
+	static const int INDEX_MASK = 3;
+	static const int FRESH = 4;
+	std::atomic<int> middle{1};
+	int back = 0;
+	int front = 2;
+};
+
+/// One block from gSamplePool for each channel
+struct PooledChannels {
+	float *block[PORT_MAX_CHANNELS] = {};
+	int allocated = 0;
+
+	float *operator[](int c) const {
+		return block[c];
+	}
+
+	/// acquire or release blocks until there is one per channel, newly acquired blocks are cleared.
+	/// Stops short if the pool has run out, see MFSamplePool::refill
+	void reserve(int channels, int size) {
+		for (; allocated > channels; allocated--) {
+			gSamplePool.release(block[allocated - 1], size);
+			block[allocated - 1] = nullptr;
+		}
+		for (; allocated < channels; allocated++) {
+			block[allocated] = gSamplePool.acquire(size);
+			if (!block[allocated])
+				break;
+			std::memset(block[allocated], 0, sizeof(float) * size);
+		}
+	}
+
+	void clear(int size) {
+		for (auto c = 0; c < allocated; c++)
+			std::memset(block[c], 0, sizeof(float) * size);
+	}
+
+	/// copy elements [start, end) of each channel
+	void copyFrom(const PooledChannels &other, int channels, int start, int end) {
+		for (auto c = 0; c < channels; c++)
+			std::memcpy(block[c] + start, other.block[c] + start, sizeof(float) * (end - start));
+	}
+};
+
+/// Samples of every channel of one input, with optional peak detect envelopes.
+/// The display reduces them to the resolution it draws at itself, see ScopeDisplay::reduceLevel,
+/// so nothing derived from the samples is kept in every snapshot
+struct ScopeTrace {
+	PooledChannels buffer;
+	PooledChannels min;
+	PooledChannels max;
+	int channels = 0;
+
+	/// make sure there are blocks for the given channels, channels is set to the number that got all of theirs
+	void reserve(int channels, int size, bool envelopes) {
+		buffer.reserve(channels, size);
+		min.reserve(envelopes ? channels : 0, size);
+		max.reserve(envelopes ? channels : 0, size);
+		this->channels = std::min(channels, buffer.allocated);
+		if (envelopes)
+			this->channels = std::min(this->channels, std::min(min.allocated, max.allocated));
+	}
+
+	void clear(int size) {
+		buffer.clear(size);
+		min.clear(size);
+		max.clear(size);
+	}
+
+	/// re-lay the ring at 2^k times the sample period, oldest first from position 0, the envelopes taking
+	/// the min and max of each 2^k samples. The rest of the ring is cleared. Returns the number of samples laid out.
+	/// Works in place, every bin is gathered from positions at or after its own and then rotated into order
+	int decimate(int writeIndex, int k, int size) {
+		auto bins = size >> k;
+		// the bin being written to is part old and part new, start after it
+		auto firstBin = ((writeIndex >> k) + 1) & (bins - 1);
+		auto count = std::max(bins - 1, 0);
+		for (auto c = 0; c < channels; c++) {
+			for (auto j = 0; j < bins; j++)
+				buffer[c][j] = buffer[c][j << k];
+			std::rotate(buffer[c], buffer[c] + firstBin, buffer[c] + bins);
+			std::memset(buffer[c] + count, 0, sizeof(float) * (size - count));
+			if (min.allocated) {
+				for (auto j = 0; j < bins; j++) {
+					auto vMin = min[c][j << k];
+					auto vMax = max[c][j << k];
+					for (auto i = (j << k) + 1; i < (j + 1) << k; i++) {
+						vMin = std::fmin(vMin, min[c][i]);
+						vMax = std::fmax(vMax, max[c][i]);
+					}
+					min[c][j] = vMin;
+					max[c][j] = vMax;
+				}
+				std::rotate(min[c], min[c] + firstBin, min[c] + bins);
+				std::rotate(max[c], max[c] + firstBin, max[c] + bins);
+				std::memset(min[c] + count, 0, sizeof(float) * (size - count));
+				std::memset(max[c] + count, 0, sizeof(float) * (size - count));
+			}
+		}
+		return count;
+	}
+
+	/// copy the samples in [start, end), for the channels reserved
+	void copyFrom(const ScopeTrace &other, int start, int end) {
+		buffer.copyFrom(other.buffer, channels, start, end);
+		if (other.min.allocated) {
+			min.copyFrom(other.min, channels, start, end);
+			max.copyFrom(other.max, channels, start, end);
+		}
+	}
+};
+
+/// Statistics of one channel over the last bufferSize captured samples
+struct ScopeStats {
+	float vMin = 0.f;
+	float vMax = 0.f;
+	// the mean is the DC offset of the channel
+	float mean = 0.f;
+	float rms = 0.f;
+};
+
+/// A sweep as seen by the display.
+/// Filled by Scope::process while it owns the slot, immutable once published.
+/// Sample storage is sized for the active bufferSize and channel count and comes from gSamplePool.
+/// Samples are kept in a ring, the sweep to display is the bufferSize samples starting at viewStart.
+struct ScopeSnapshot {
+	ScopeTrace traceX;
+	ScopeTrace traceY;
+	// ring position the sweep starts at, and how many of its samples belong to the current sweep
+	int viewStart = 0;
+	int bufferIndex = 0;
+	// samples from the start of the sweep that hold signal, the rest of the ring has not been written since
+	// a restart or a re-zoom and is left undrawn
+	int filled = 0;
+	int bufferSize = 512;
+	bool peakDetect = false;
+	// seconds between captured samples
+	float samplePeriod = 0.f;
+	// ring position of the next sample, and the total number of samples written
+	int writeIndex = 0;
+	uint64_t written = 0;
+	// changes whenever samples are moved or cleared rather than appended.
+	// Together with written it tells which samples differ between two snapshots
+	uint64_t layout = 0;
+	// incremented on every publish, lets readers tell a new sweep from one already seen
+	uint64_t generation = 0;
+	ScopeStats statsX[PORT_MAX_CHANNELS];
+	ScopeStats statsY[PORT_MAX_CHANNELS];
+
+	ScopeSnapshot() = default;
+	ScopeSnapshot(const ScopeSnapshot &) = delete;
+	ScopeSnapshot &operator=(const ScopeSnapshot &) = delete;
+
+	~ScopeSnapshot() {
+		reserve(0, 0, blockSize, false);
+	}
+
+	/// ring position of sample i of the sweep
+	int ringIndex(int i) const {
+		return (viewStart + i) & (bufferSize - 1);
+	}
+
+	/// make sure there is a block for each channel of the given size, plus envelopes when peak detecting.
+	/// Only blocks that are newly acquired are cleared, the rest keep their samples.
+	/// If the pool runs short the traces get fewer channels than asked for
+	void reserve(int channelsX, int channelsY, int size, bool envelopes) {
+		if (size != blockSize) {
+			reserve(0, 0, blockSize, false);
+			blockSize = size;
+		}
+		traceX.reserve(channelsX, size, envelopes);
+		traceY.reserve(channelsY, size, envelopes);
+		layout++;
+	}
+
+	void clear() {
+		traceX.clear(blockSize);
+		traceY.clear(blockSize);
+		layout++;
+	}
+
+	void decimate(int k) {
+		traceX.decimate(writeIndex, k, bufferSize);
+		writeIndex = traceY.decimate(writeIndex, k, bufferSize);
+		layout++;
+	}
+
+	/// bring this snapshot up to date with another, copying only the samples written since they diverged
+	void copyFrom(const ScopeSnapshot &other) {
+		auto size = other.bufferSize;
+		auto complete = true;
+		if (layout != other.layout || written > other.written || other.written - written >= (uint64_t) size) {
+			reserve(other.traceX.channels, other.traceY.channels, size, other.peakDetect);
+			complete = traceX.channels == other.traceX.channels && traceY.channels == other.traceY.channels;
+			traceX.copyFrom(other.traceX, 0, size);
+			traceY.copyFrom(other.traceY, 0, size);
+		} else if (writeIndex <= other.writeIndex) {
+			traceX.copyFrom(other.traceX, writeIndex, other.writeIndex);
+			traceY.copyFrom(other.traceY, writeIndex, other.writeIndex);
+		} else {
+			// the samples written wrap around the end of the ring
+			traceX.copyFrom(other.traceX, writeIndex, size);
+			traceY.copyFrom(other.traceY, writeIndex, size);
+			traceX.copyFrom(other.traceX, 0, other.writeIndex);
+			traceY.copyFrom(other.traceY, 0, other.writeIndex);
+		}
+		viewStart = other.viewStart;
+		bufferIndex = other.bufferIndex;
+		filled = other.filled;
+		bufferSize = other.bufferSize;
+		peakDetect = other.peakDetect;
+		samplePeriod = other.samplePeriod;
+		writeIndex = other.writeIndex;
+		written = other.written;
+		// a copy the pool could not supply every channel for is made in full again next time
+		layout = complete ? other.layout : other.layout - 1;
+		generation = other.generation;
+		std::copy(other.statsX, other.statsX + PORT_MAX_CHANNELS, statsX);
+		std::copy(other.statsY, other.statsY + PORT_MAX_CHANNELS, statsY);
+	}
+
+private:
+	int blockSize = 0;
+};
+
+/// Schmitt triggers for every channel of a polyphonic input, run four channels at a time
+struct TriggerBank {
+	dsp::TSchmittTrigger<simd::float_4> triggers[PORT_MAX_CHANNELS / 4];
+
+	void reset() {
+		for (auto &trigger : triggers) {
+			trigger.reset();
+		}
+	}
+
+	/// returns the first channel crossing threshold upwards, or -1 if none did
+	int process(Input &input, float threshold) {
+		// This may be 0
+		auto channels = input.getChannels();
+		for (auto c = 0; c < channels; c += 4) {
+			// same as rescale(v, threshold, threshold + 0.001f, 0.f, 1.f) per channel
+			auto v = input.getVoltageSimd<simd::float_4>(c);
+			auto fired = simd::movemask(triggers[c / 4].process((v - threshold) * 1000.f));
+			// ignore lanes past the last channel
+			fired &= (1 << std::min(channels - c, 4)) - 1;
+			if (fired) {
+				auto lane = 0;
+				while (!(fired & (1 << lane)))
+					lane++;
+				return c + lane;
+			}
+		}
+		return -1;
+	}
+};
+
+/// Running minimum and maximum of every channel of a polyphonic input over one decimation interval
+struct PeakDetector {
+	simd::float_4 vMin[PORT_MAX_CHANNELS / 4];
+	simd::float_4 vMax[PORT_MAX_CHANNELS / 4];
+
+	PeakDetector() {
+		reset();
+	}
+
+	void reset() {
+		for (auto i = 0; i < PORT_MAX_CHANNELS / 4; i++) {
+			vMin[i] = INFINITY;
+			vMax[i] = -INFINITY;
+		}
+	}
+
+	void process(Input &input, int channels) {
+		for (auto c = 0; c < channels; c += 4) {
+			auto v = input.getVoltageSimd<simd::float_4>(c);
+			vMin[c / 4] = simd::fmin(vMin[c / 4], v);
+			vMax[c / 4] = simd::fmax(vMax[c / 4], v);
+		}
+	}
+
+	/// store the peaks of the interval just ended at index, and start a new interval
+	void capture(int channels, float **minBuffer, float **maxBuffer, int index) {
+		for (auto c = 0; c < channels; c++) {
+			minBuffer[c][index] = vMin[c / 4][c % 4];
+			maxBuffer[c][index] = vMax[c / 4][c % 4];
+		}
+		reset();
+	}
+};
+
+/// Running min, max, mean and RMS of every channel, four channels at a time
+struct StatsAccumulator {
+	simd::float_4 vMin[PORT_MAX_CHANNELS / 4];
+	simd::float_4 vMax[PORT_MAX_CHANNELS / 4];
+	simd::float_4 sum[PORT_MAX_CHANNELS / 4];
+	simd::float_4 sumSquares[PORT_MAX_CHANNELS / 4];
+	int count = 0;
+
+	StatsAccumulator() {
+		reset();
+	}
+
+	void reset() {
+		for (auto i = 0; i < PORT_MAX_CHANNELS / 4; i++) {
+			vMin[i] = INFINITY;
+			vMax[i] = -INFINITY;
+			sum[i] = 0.f;
+			sumSquares[i] = 0.f;
+		}
+		count = 0;
+	}
+
+	/// add the current voltage of each channel
+	void process(Input &input, int channels) {
+		for (auto c = 0; c < channels; c += 4) {
+			auto v = input.getVoltageSimd<simd::float_4>(c);
+			vMin[c / 4] = simd::fmin(vMin[c / 4], v);
+			vMax[c / 4] = simd::fmax(vMax[c / 4], v);
+			sum[c / 4] += v;
+			sumSquares[c / 4] += v * v;
+		}
+		count++;
+	}
+
+	/// widen min and max to the peaks seen between captured samples
+	void include(const PeakDetector &peaks, int channels) {
+		for (auto c = 0; c < channels; c += 4) {
+			vMin[c / 4] = simd::fmin(vMin[c / 4], peaks.vMin[c / 4]);
+			vMax[c / 4] = simd::fmax(vMax[c / 4], peaks.vMax[c / 4]);
+		}
+	}
+
+	/// store the statistics of the samples added so far, and start again
+	void finish(int channels, ScopeStats *stats) {
+		for (auto c = 0; c < channels; c += 4) {
+			auto mean = sum[c / 4] / count;
+			auto rms = simd::sqrt(sumSquares[c / 4] / count);
+			for (auto lane = 0; lane < std::min(channels - c, 4); lane++) {
+				stats[c + lane].vMin = vMin[c / 4][lane];
+				stats[c + lane].vMax = vMax[c / 4][lane];
+				stats[c + lane].mean = mean[lane];
+				stats[c + lane].rms = rms[lane];
+			}
+		}
+		reset();
+	}
+};
+
 struct Scope : Module {
 	enum ParamIds {
 		X_SCALE_PARAM,
@@ -103,16 +487,63 @@ struct Scope : Module {
 		NORMAL,
 		LISSAJOUS,
 		KALEIDOSCOPE,
+		SPECTRUM,
 		NUM_PLOT_TYPES
 	};
 
-	float bufferX[PORT_MAX_CHANNELS][MAX_BUFFER_SIZE] = {};
-	float bufferY[PORT_MAX_CHANNELS][MAX_BUFFER_SIZE] = {};
+	// samples are written straight into the writer's snapshot,
+	// the display only ever sees published snapshots
+	TripleBuffer<ScopeSnapshot> snapshots;
 	int channelsX = 0;
 	int channelsY = 0;
-	int bufferIndex = 0;
 	int frameIndex = 0;
 	int bufferSize = 512;
+	// samples are captured into a ring continuously, a trigger only marks where the next sweep is taken from
+	int writeIndex = 0;
+	uint64_t written = 0;
+	bool armed = true;
+	int triggerIndex = 0;
+	// samples captured since the trigger, and samples waited for one
+	int postCount = 0;
+	int holdIndex = 0;
+	// fraction of the sweep shown before the trigger point
+	float preTrigger = 0.f;
+	// keep the min and max of every decimation interval as well as the point sample
+	bool peakDetect = false;
+	PeakDetector peaksX;
+	PeakDetector peaksY;
+	// statistics are gathered as samples are captured, and published with the sweep
+	StatsAccumulator statsX;
+	StatsAccumulator statsY;
+	// channel shown in the stats overlay, or -1 for all channels together
+	int statsChannel = -1;
+	// number of alpha and width steps a fading trace is stroked in, 0 strokes every segment separately
+	int fadeBands = 16;
+	// half-life in seconds of the phosphor display, 0 turns it off and a negative value never fades
+	float persistence = 0.f;
+	// frame rate the pop-out window is limited to, 0 follows the display refresh
+	int popOutFps = 0;
+	// draw offscreen traces with MFTraceRenderer rather than nanovg
+	bool gpuLines = false;
+
+	// plot type after cv, see processControls
+	int plotType = PlotType::NORMAL;
+	// settings for the spectrum plot, which is computed by the display
+	int spectrumSize = 2048;
+	float spectrumOverlap = 0.5f;
+	bool spectrumLogFrequency = true;
+	// frameCount the current sweep was captured with, -1 until the first control block, see processControls
+	int sweepFrameCount = -1;
+	// value of written when the ring started filling at sweepFrameCount
+	uint64_t sweepStart = 0;
+	// number of samples in the ring that hold signal, less than bufferSize after a restart or a re-zoom
+	int ringFilled = 0;
+	// partially filled sweeps are published at roughly the UI frame rate
+	int publishIndex = 0;
+	// samples until storage the pool fell short of is asked for again, see process
+	int reserveRetry = 0;
+	// set while some connected channels are not captured for lack of storage, shown in the context menu
+	std::atomic<bool> storageShort{false};
 
 	//parameters for kaleidoscope
 	struct Kaleidoscope {
@@ -120,7 +551,7 @@ struct Scope : Module {
 		float radius = 20.0f;
 	} kaleidoscope;
 
-	dsp::SchmittTrigger triggers[16];
+	TriggerBank triggers;
 
 	// used to calculate parameter + cv values
 	float hue = 0.5f;
@@ -128,6 +559,18 @@ struct Scope : Module {
 	float fade = 1.0f;
 	std::atomic<float> widgetWidth;
 
+	// control rate state, updated by processControls
+	dsp::ClockDivider controlDivider;
+	int controlDivision = 32;
+	int frameCount = 1;
+	float samplePeriod = 0.f;
+	int publishInterval = 1;
+	int holdFrames = 0;
+	bool externalTrigger = false;
+	bool freeRun = false;
+	float trigThreshold = 0.f;
+	float trigThresholdStep = 0.f;
+
 	Scope() {
 		widgetWidth.store(RACK_GRID_WIDTH * 20);
 
@@ -155,17 +598,129 @@ struct Scope : Module {
 		configParam(SHOW_LABELS_PARAM, 0.0f, 1.0f, 0.0f, "Show Labels");
 		configParam(PLOT_TYPE_PARAM, 0.0f, NUM_PLOT_TYPES - 1, Scope::PlotType::NORMAL, "Plot Type");
 		configParam(EXT_WINDOW_ALPHA_PARAM, 0.0f, 1.0f, 1.0f, "External Window Alpha");
+		prefill(bufferSize, peakDetect);
+	}
+
+	/// put blocks for every channel of both inputs in all three snapshots into gSamplePool, so the audio thread
+	/// can capture at the given settings before the UI first refills the pool, or without a UI at all.
+	/// Call before changing bufferSize or peakDetect. With a UI, blocks that go unused are trimmed again
+	void prefill(int size, bool envelopes) {
+		gSamplePool.prefill(size, 2 * PORT_MAX_CHANNELS * 3 * (envelopes ? 3 : 1));
 	}
 
 	void onReset() override {
 		params[LISSAJOUS_PARAM].setValue(false);
 		params[EXTERNAL_PARAM].setValue(false);
 		params[KALEIDOSCOPE_USE_PARAM].setValue(false);
-		std::memset(bufferX, 0, sizeof(bufferX));
-		std::memset(bufferY, 0, sizeof(bufferY));
+		snapshots.writeSlot().clear();
+		restart();
+		publish();
 	}
 
 	void process(const ProcessArgs &args) override {
+		// parameters are evaluated once per block of controlDivision samples,
+		// only capture and triggering run on every sample
+		if (controlDivider.getClock() == 0)
+			processControls(args);
+		controlDivider.process();
+		trigThreshold += trigThresholdStep;
+
+		// Set channels, storage is only swapped when the channel count, buffer size or acquisition mode changes
+		auto &snapshot = snapshots.writeSlot();
+		auto channelsX = inputs[X_INPUT].getChannels();
+		auto channelsY = inputs[Y_INPUT].getChannels();
+		auto changed = channelsX != this->channelsX || channelsY != this->channelsY
+			|| bufferSize != snapshot.bufferSize || peakDetect != snapshot.peakDetect;
+		// channels the pool had no storage for are asked for again once per UI frame, when it may have been refilled
+		auto starved = channelsX != snapshot.traceX.channels || channelsY != snapshot.traceY.channels;
+		if (changed || (starved && --reserveRetry <= 0)) {
+			if (bufferSize != snapshot.bufferSize || peakDetect != snapshot.peakDetect) {
+				restart();
+			}
+			if (channelsX != this->channelsX || channelsY != this->channelsY) {
+				statsX.reset();
+				statsY.reset();
+			}
+			snapshot.reserve(channelsX, channelsY, bufferSize, peakDetect);
+			snapshot.bufferSize = bufferSize;
+			snapshot.peakDetect = peakDetect;
+			this->channelsX = channelsX;
+			this->channelsY = channelsY;
+			reserveRetry = (int) (args.sampleRate / 60);
+			storageShort = snapshot.traceX.channels != channelsX || snapshot.traceY.channels != channelsY;
+		}
+		// until the UI thread has refilled the pool only the channels with storage are captured
+		channelsX = snapshot.traceX.channels;
+		channelsY = snapshot.traceY.channels;
+
+		// Add frame to the ring, acquisition never stops so there is no dead time after a sweep
+		// peaks are tracked on every sample, not just the ones captured
+		if (peakDetect) {
+			peaksX.process(inputs[X_INPUT], channelsX);
+			peaksY.process(inputs[Y_INPUT], channelsY);
+		}
+		if (++frameIndex > frameCount) {
+			frameIndex = 0;
+			capture(inputs[X_INPUT], channelsX, snapshot.traceX.buffer.block);
+			capture(inputs[Y_INPUT], channelsY, snapshot.traceY.buffer.block);
+			statsX.process(inputs[X_INPUT], channelsX);
+			statsY.process(inputs[Y_INPUT], channelsY);
+			if (peakDetect) {
+				statsX.include(peaksX, channelsX);
+				statsY.include(peaksY, channelsY);
+				peaksX.capture(channelsX, snapshot.traceX.min.block, snapshot.traceX.max.block, writeIndex);
+				peaksY.capture(channelsY, snapshot.traceY.min.block, snapshot.traceY.max.block, writeIndex);
+			}
+			writeIndex = (writeIndex + 1) & (bufferSize - 1);
+			written++;
+			ringFilled = std::min(ringFilled + 1, bufferSize);
+			if (statsX.count >= bufferSize) {
+				statsX.finish(channelsX, snapshot.statsX);
+				statsY.finish(channelsY, snapshot.statsY);
+			}
+
+			if (!armed) {
+				// hand finished sweeps to the display straight away, partial ones at UI rate
+				if (++postCount >= bufferSize - preTriggerCount()) {
+					publish();
+					arm();
+				} else if (++publishIndex >= publishInterval) {
+					publish();
+				}
+			}
+		}
+
+		// Don't look for a trigger while the current sweep is still filling
+		if (!armed) {
+			return;
+		}
+
+		// Trigger immediately if external but nothing plugged in, or in Lissajous mode
+		if (freeRun) {
+			trigger();
+			return;
+		}
+
+		holdIndex++;
+
+		// Reset if triggered
+		Input &trigInput = externalTrigger ? inputs[TRIG_INPUT] : inputs[X_INPUT];
+
+		if (triggers.process(trigInput, trigThreshold) >= 0) {
+			trigger();
+			return;
+		}
+
+		// Reset if we've been waiting for `holdTime`
+		if (holdIndex >= holdFrames) {
+			trigger();
+			return;
+		}
+	}
+
+	void processControls(const ProcessArgs &args) {
+		controlDivider.setDivision(controlDivision);
+
 		//kaleidoscope parameters
 		kaleidoscope.count = (int) clamp(
 				params[KALEIDOSCOPE_COUNT_PARAM].getValue() + inputs[KALEIDOSCOPE_COUNT_INPUT].getVoltage(), 3.0f,
@@ -181,6 +736,7 @@ struct Scope : Module {
 		//KALEIDOSCOPE_USE_PARAM and LISSAJOUS_PARAM are updated for compatibility
 		auto pType = (int) (params[PLOT_TYPE_PARAM].getValue() + inputs[PLOT_TYPE_INPUT].getVoltage() / 3.0f);
 		pType = clamp(pType, 0, NUM_PLOT_TYPES - 1);
+		plotType = pType;
 		switch ((PlotType) pType) {
 			case PlotType::NORMAL:
 				params[KALEIDOSCOPE_USE_PARAM].setValue(false);
@@ -194,6 +750,10 @@ struct Scope : Module {
 				params[KALEIDOSCOPE_USE_PARAM].setValue(false);
 				params[LISSAJOUS_PARAM].setValue(true);
 				break;
+			case PlotType::SPECTRUM:
+				params[KALEIDOSCOPE_USE_PARAM].setValue(false);
+				params[LISSAJOUS_PARAM].setValue(false);
+				break;
 			default:
 				params[KALEIDOSCOPE_USE_PARAM].setValue(false);
 				params[LISSAJOUS_PARAM].setValue(false);
@@ -205,85 +765,137 @@ struct Scope : Module {
 		auto deltaTime = std::pow(2.f,
 								  -clamp(params[TIME_PARAM].getValue() + abs(inputs[TIME_INPUT].getVoltage()), 6.0f,
 										 16.0f));
-		auto frameCount = (int) std::ceil(deltaTime * args.sampleRate);
-
-		// Set channels
-		auto channelsX = inputs[X_INPUT].getChannels();
-		if (channelsX != this->channelsX) {
-			std::memset(bufferX, 0, sizeof(bufferX));
-			this->channelsX = channelsX;
-		}
-
-		int channelsY = inputs[Y_INPUT].getChannels();
-		if (channelsY != this->channelsY) {
-			std::memset(bufferY, 0, sizeof(bufferY));
-			this->channelsY = channelsY;
-		}
-
-		// Add frame to buffer
-		if (bufferIndex < bufferSize) {
-			if (++frameIndex > frameCount) {
-				frameIndex = 0;
-				for (auto c = 0; c < channelsX; c++) {
-					bufferX[c][bufferIndex] = inputs[X_INPUT].getVoltage(c);
-				}
-				for (auto c = 0; c < channelsY; c++) {
-					bufferY[c][bufferIndex] = inputs[Y_INPUT].getVoltage(c);
-				}
-				bufferIndex++;
-			}
-		}
-
-		// Don't wait for trigger if still filling buffer
-		if (bufferIndex < bufferSize) {
-			return;
+		frameCount = (int) std::ceil(deltaTime * args.sampleRate);
+		samplePeriod = (frameCount + 1) * args.sampleTime;
+		publishInterval = (int) (args.sampleRate / 60) / frameCount;
+
+		// When the time base slows down by 2x or more, re-lay the ring at the new rate
+		// and show it straight away, instead of waiting for a whole sweep at the new rate.
+		// Only a ring filled at the old rate is re-laid, while it fills the time base is just followed
+		if (sweepFrameCount < 0 || frameCount < sweepFrameCount) {
+			startSweepRate();
+		} else if (frameCount + 1 >= 2 * (sweepFrameCount + 1) && written - sweepStart >= (uint64_t) bufferSize) {
+			auto k = 1;
+			while (frameCount + 1 >= (4 << (k - 1)) * (sweepFrameCount + 1) && (bufferSize >> k) > 2)
+				k++;
+			auto &snapshot = snapshots.writeSlot();
+			snapshot.writeIndex = writeIndex;
+			snapshot.decimate(k);
+			writeIndex = snapshot.writeIndex;
+			ringFilled = writeIndex;
+			sweepFrameCount = frameCount;
+			// the laid out samples count as captured at the new rate
+			sweepStart = written - ringFilled;
+			arm();
+			publish();
 		}
 
 		// Trigger immediately if external but nothing plugged in, or in Lissajous mode
-		if ((bool) params[LISSAJOUS_PARAM].getValue()
-			|| ((bool) params[EXTERNAL_PARAM].getValue() && !inputs[TRIG_INPUT].isConnected())) {
-			trigger();
-			return;
-		}
+		externalTrigger = (bool) params[EXTERNAL_PARAM].getValue();
+		freeRun = (bool) params[LISSAJOUS_PARAM].getValue() || (externalTrigger && !inputs[TRIG_INPUT].isConnected());
 
-		frameIndex++;
+		// the threshold ramps to its new value over the block, so a moving trigger level cv doesn't step
+		auto threshold = params[TRIG_PARAM].getValue();
+		threshold += inputs[Scope::TRIG_LEVEL_INPUT].getVoltage();
+		threshold = clamp(threshold, -10.0f, 10.0f);
+		trigThresholdStep = (threshold - trigThreshold) / controlDivider.getDivision();
 
-		// Reset if triggered
-		auto trigThreshold = params[TRIG_PARAM].getValue();
-		trigThreshold += inputs[Scope::TRIG_LEVEL_INPUT].getVoltage();
-		trigThreshold = clamp(trigThreshold, -10.0f, 10.0f);
-		Input &trigInput = (bool) params[EXTERNAL_PARAM].getValue() ? inputs[TRIG_INPUT] : inputs[X_INPUT];
+		// Reset if we've been waiting for `holdTime`
+		const float holdTime = 0.1f;
+		holdFrames = (int) (holdTime * args.sampleRate);
+	}
 
-		// This may be 0
-		auto trigChannels = trigInput.getChannels();
-		for (auto c = 0; c < trigChannels; c++) {
-			auto trigVoltage = trigInput.getVoltage(c);
-			if (triggers[c].process(rescale(trigVoltage, trigThreshold, trigThreshold + 0.001f, 0.f, 1.f))) {
-				trigger();
-				return;
+	/// store the current voltage of each channel at writeIndex, reading four channels at a time
+	void capture(Input &input, int channels, float **buffer) {
+		for (auto c = 0; c < channels; c += 4) {
+			auto v = input.getVoltageSimd<simd::float_4>(c);
+			for (auto lane = 0; lane < std::min(channels - c, 4); lane++) {
+				buffer[c + lane][writeIndex] = v[lane];
 			}
 		}
+	}
 
-		// Reset if we've been waiting for `holdTime`
-		const float holdTime = 0.1f;
-		if (frameIndex * args.sampleTime >= holdTime) {
-			trigger();
-			return;
-		}
+	/// number of samples of a sweep that were captured before its trigger
+	int preTriggerCount() {
+		return std::min((int) (preTrigger * bufferSize), bufferSize - 1);
+	}
+
+	/// the ring starts filling at the current frameCount
+	void startSweepRate() {
+		sweepFrameCount = frameCount;
+		sweepStart = written;
 	}
 
 	void trigger() {
-		for (auto &trigger : triggers) {
-			trigger.reset();
-		}
-		bufferIndex = 0;
+		triggers.reset();
+		if (frameCount != sweepFrameCount)
+			startSweepRate();
+		armed = false;
+		triggerIndex = writeIndex;
+		postCount = 0;
+	}
+
+	/// start looking for the next trigger
+	void arm() {
+		armed = true;
+		holdIndex = 0;
+	}
+
+	/// start acquisition again from an empty ring
+	void restart() {
+		writeIndex = 0;
 		frameIndex = 0;
+		ringFilled = 0;
+		// taken up again by the next control block
+		sweepFrameCount = -1;
+		peaksX.reset();
+		peaksY.reset();
+		statsX.reset();
+		statsY.reset();
+		arm();
+	}
+
+	/// make the writer's snapshot visible to the display.
+	/// Between sweeps the newest bufferSize samples are shown, otherwise the sweep around the last trigger.
+	/// The slot handed back is stale, so it is brought up to date to continue the sweep.
+	void publish() {
+		publishIndex = 0;
+		auto &snapshot = snapshots.writeSlot();
+		if (armed) {
+			// the part of the ring not filled yet is left out rather than drawn as 0V
+			snapshot.viewStart = (writeIndex - ringFilled) & (bufferSize - 1);
+			snapshot.bufferIndex = ringFilled;
+		} else {
+			// samples from before the ring was filled are not part of the sweep
+			auto preCount = std::min(preTriggerCount(), std::max(ringFilled - postCount, 0));
+			snapshot.viewStart = (triggerIndex - preCount) & (bufferSize - 1);
+			snapshot.bufferIndex = std::min(preCount + postCount, bufferSize);
+		}
+		snapshot.filled = ringFilled >= bufferSize ? bufferSize : snapshot.bufferIndex;
+		snapshot.writeIndex = writeIndex;
+		snapshot.written = written;
+		snapshot.bufferSize = bufferSize;
+		snapshot.samplePeriod = samplePeriod;
+		snapshot.generation++;
+		auto &published = snapshots.slots[snapshots.publish()];
+		snapshots.writeSlot().copyFrom(published);
 	}
 
 	json_t *dataToJson() override {
 		json_t *rootJ = json_object();
 		json_object_set_new(rootJ, "WidgetWidth", json_real(widgetWidth.load()));
 		json_object_set_new(rootJ, "bufferSize", json_integer(bufferSize));
+		json_object_set_new(rootJ, "peakDetect", json_boolean(peakDetect));
+		json_object_set_new(rootJ, "preTrigger", json_real(preTrigger));
+		json_object_set_new(rootJ, "controlDivision", json_integer(controlDivision));
+		json_object_set_new(rootJ, "statsChannel", json_integer(statsChannel));
+		json_object_set_new(rootJ, "fadeBands", json_integer(fadeBands));
+		json_object_set_new(rootJ, "persistence", json_real(persistence));
+		json_object_set_new(rootJ, "popOutFps", json_integer(popOutFps));
+		json_object_set_new(rootJ, "gpuLines", json_boolean(gpuLines));
+		json_object_set_new(rootJ, "spectrumSize", json_integer(spectrumSize));
+		json_object_set_new(rootJ, "spectrumOverlap", json_real(spectrumOverlap));
+		json_object_set_new(rootJ, "spectrumLogFrequency", json_boolean(spectrumLogFrequency));
 		return rootJ;
 	}
 
@@ -293,8 +905,57 @@ struct Scope : Module {
 			widgetWidth.store((float) json_real_value(ww));
 
 		json_t *bs = json_object_get(rootJ, "bufferSize");
-		if (bs)
+		// the ring is indexed with a mask, so only power of two sizes are accepted
+		if (bs && isPow2(json_integer_value(bs)) && json_integer_value(bs) <= MAX_BUFFER_SIZE)
 			bufferSize = json_integer_value(bs);
+
+		json_t *pd = json_object_get(rootJ, "peakDetect");
+		if (pd)
+			peakDetect = json_is_true(pd);
+
+		// the constructor prefilled for the default settings
+		if (bufferSize != 512 || peakDetect)
+			prefill(bufferSize, peakDetect);
+
+		json_t *pt = json_object_get(rootJ, "preTrigger");
+		if (pt)
+			preTrigger = clamp((float) json_real_value(pt), 0.f, 0.9f);
+
+		json_t *cd = json_object_get(rootJ, "controlDivision");
+		if (cd)
+			controlDivision = std::max((int) json_integer_value(cd), 1);
+
+		json_t *sc = json_object_get(rootJ, "statsChannel");
+		if (sc)
+			statsChannel = clamp((int) json_integer_value(sc), -1, PORT_MAX_CHANNELS - 1);
+
+		json_t *fb = json_object_get(rootJ, "fadeBands");
+		if (fb)
+			fadeBands = std::max((int) json_integer_value(fb), 0);
+
+		json_t *ps = json_object_get(rootJ, "persistence");
+		if (ps)
+			persistence = json_real_value(ps);
+
+		json_t *pf = json_object_get(rootJ, "popOutFps");
+		if (pf)
+			popOutFps = clamp((int) json_integer_value(pf), 0, 240);
+
+		json_t *gl = json_object_get(rootJ, "gpuLines");
+		if (gl)
+			gpuLines = json_is_true(gl);
+
+		json_t *ss = json_object_get(rootJ, "spectrumSize");
+		if (ss && isPow2(json_integer_value(ss)) && json_integer_value(ss) >= 32)
+			spectrumSize = std::min((int) json_integer_value(ss), 16384);
+
+		json_t *so = json_object_get(rootJ, "spectrumOverlap");
+		if (so)
+			spectrumOverlap = clamp((float) json_real_value(so), 0.f, 0.9f);
+
+		json_t *sl = json_object_get(rootJ, "spectrumLogFrequency");
+		if (sl)
+			spectrumLogFrequency = json_is_true(sl);
 	}
 };
 
@@ -381,55 +1042,360 @@ struct ScopePanel : Widget {
 
 struct ScopeDisplay : ModuleLightWidget {
 	Scope *module;
-	int statsFrame = 0;
+	// latest sweep published by the module, acquired once per draw
+	const ScopeSnapshot *snapshot = nullptr;
+	// sweeps forwarded by the UI thread, for a display drawn on another thread, see ScopePopOut
+	TripleBuffer<ScopeSnapshot> *sweeps = nullptr;
+	// frequency measurement runs on its own thread, started the first time stats are shown
+	std::unique_ptr<MFMeasurement> measurement;
+	uint64_t measuredGeneration = 0;
+	// likewise the spectrum plot, started the first time it is shown
+	std::unique_ptr<MFSpectrum> spectrum;
+	uint64_t spectrumGeneration = 0;
+	// the kaleidoscope's base trace is drawn once into a framebuffer, and every reflection is a copy of it
+	MFFramebuffer kaleidoscopeFramebuffer;
+	// The phosphor display accumulates traces in a framebuffer that fades a little every frame,
+	// so each frame only draws the samples captured since the last one
+	struct Phosphor {
+		MFFramebuffer framebuffer;
+		// sweep being drawn, identified by the number of samples written before it started
+		uint64_t sweepStart = 0;
+		uint64_t layout = 0;
+		int drawnIndex = 0;
+		double time = 0.0;
+		// decay built up since it was last applied, see renderPhosphor
+		float decay = 1.f;
+	};
+	Phosphor phosphor;
+	// The trace layer is cached in a framebuffer, and only redrawn when the sweep or something
+	// it is drawn with changes. The phosphor display changes every frame and isn't cached
+	struct TraceCache {
+		MFFramebuffer framebuffer;
+		bool valid = false;
+		// sweep generation the layer was drawn from
+		uint64_t generation = 0;
+		// the parameters and settings it was drawn with, parameterGeneration counts their changes
+		std::array<double, Scope::NUM_PARAMS + 24> parameters = {};
+		uint64_t parameterGeneration = 0;
+	};
+	TraceCache traceCache;
+	// offscreen rendering is skipped for displays that weren't drawn last frame, e.g. scrolled out of view
+	bool drawn = false;
+	// scale of the display on screen at the last draw, so framebuffers match the pixels they cover
+	float drawScale = 1.f;
+	float devicePixelRatio = 1.f;
 	std::shared_ptr<Font> font;
 	Vec lastCoordinate;
+	// screen space points of the trace being drawn, in sweep order, see transformTrace.
+	// A reduced trace has two points for each bin, plus a bin that straddles the start
+	float vertexX[MAX_BUFFER_SIZE + 2];
+	float vertexY[MAX_BUFFER_SIZE + 2];
+	float reflectedX[MAX_BUFFER_SIZE + 2];
+	float reflectedY[MAX_BUFFER_SIZE + 2];
+	// min and max of each bin of the channel being drawn when it is reduced, see reduceLevel
+	float levelMin[MAX_BUFFER_SIZE / 2];
+	float levelMax[MAX_BUFFER_SIZE / 2];
+	// number of points, and the point the newest sample is at
+	int vertexCount = 0;
+	int vertexIndex = 0;
+	// changes whenever the points are recomputed, so the GPU renderer uploads each trace once
+	uint64_t vertexGeneration = 0;
+	// screen pixels per unit of the display being drawn, for level of detail
+	float pixelScale = 1.f;
+	// draws the traces of offscreen passes when the module's gpuLines is set
+	MFTraceRenderer lineRenderer;
+	// set on the display in the rack while the pop-out window is open, it then draws nothing but stats and labels
 	bool externalWindow = false;
 
-	struct Stats {
-		float vpp = 0.f;
-		float vMin = 0.f;
-		float vMax = 0.f;
-
-		void calculate(float *buffer, int channels) {
-			vMax = -INFINITY;
-			vMin = INFINITY;
-			for (auto i = 0; i < MAX_BUFFER_SIZE * channels; i++) {
-				auto v = buffer[i];
-				vMax = std::fmax(vMax, v);
-				vMin = std::fmin(vMin, v);
+	/// combine the published statistics of the selected channel, or of all channels
+	static ScopeStats selectStats(const ScopeStats *stats, int channels, int channel) {
+		if (channel >= 0)
+			return channel < channels ? stats[channel] : ScopeStats();
+		if (channels == 0)
+			return ScopeStats();
+		ScopeStats all;
+		all.vMin = INFINITY;
+		all.vMax = -INFINITY;
+		auto sumSquares = 0.f;
+		for (auto c = 0; c < channels; c++) {
+			all.vMin = std::fmin(all.vMin, stats[c].vMin);
+			all.vMax = std::fmax(all.vMax, stats[c].vMax);
+			all.mean += stats[c].mean / channels;
+			sumSquares += stats[c].rms * stats[c].rms;
+		}
+		all.rms = std::sqrt(sumSquares / channels);
+		return all;
+	}
+
+	ScopeDisplay() {
+		// there is no window in the headless benchmark, which sets the font itself
+		if (APP->window)
+			font = APP->window->loadFont(asset::system("res/fonts/ShareTechMono-Regular.ttf"));
+	}
+
+	/// the module's snapshots have one reader, the UI thread, other displays read what it forwards them
+	const ScopeSnapshot &readSnapshot() {
+		return sweeps ? sweeps->read() : module->snapshots.read();
+	}
+
+	/// map a channel's samples to the points drawWaveform emits, in sweep order, four samples at a time.
+	/// Without bufferX the x axis is time
+	void transformTrace(const float *bufferX,
+						float offsetX,
+						float gainX,
+						const float *bufferY,
+						float offsetY,
+						float gainY,
+						Rect bounds) {
+		auto b = Rect(Vec(0, 15), bounds.size.minus(Vec(0, 15 * 2)));
+		auto bufferSize = snapshot->bufferSize;
+		// x & y are both scaled by height if Lissajous, to keep plots in the correct ratio
+		auto scaleX = (bool) module->params[Scope::LISSAJOUS_PARAM].getValue() ? b.pos.y + b.size.y - b.pos.x : b.size.x;
+		auto scaleY = -b.size.y;
+		auto originX = b.pos.x;
+		auto originY = b.pos.y + b.size.y;
+		vertexCount = snapshot->filled;
+		vertexIndex = snapshot->bufferIndex;
+		vertexGeneration++;
+		auto factorX = gainX / 2.0f * scaleX;
+		auto factorY = gainY / 2.0f * scaleY;
+		auto timeFactor = scaleX / (bufferSize - 1);
+
+		// the sweep is two runs of the ring, from viewStart towards the end and from the start towards viewStart,
+		// as far as the ring is filled
+		auto i = 0;
+		auto filledEnd = snapshot->viewStart + snapshot->filled;
+		for (auto run = 0; run < 2; run++) {
+			auto r = run == 0 ? snapshot->viewStart : 0;
+			auto end = run == 0 ? std::min(filledEnd, bufferSize) : std::max(filledEnd - bufferSize, 0);
+			for (; r + 4 <= end; r += 4, i += 4) {
+				auto y = (simd::float_4::load(bufferY + r) + offsetY) * factorY + originY;
+				y.store(vertexY + i);
+				simd::float_4 x;
+				if (bufferX)
+					x = (simd::float_4::load(bufferX + r) + offsetX) * factorX + originX;
+				else
+					x = simd::float_4(i, i + 1, i + 2, i + 3) * timeFactor + originX;
+				x.store(vertexX + i);
+			}
+			for (; r < end; r++, i++) {
+				vertexY[i] = (bufferY[r] + offsetY) * factorY + originY;
+				vertexX[i] = bufferX ? (bufferX[r] + offsetX) * factorX + originX : i * timeFactor + originX;
 			}
-			vpp = vMax - vMin;
 		}
-	};
+	}
 
-	Stats statsX, statsY;
+	/// number of bins of 2^level samples from firstBin that only hold filled samples, see ScopeSnapshot::filled.
+	/// A full ring has one more, the bin straddling the start of the sweep is drawn again at the end
+	int filledBins(int level, float firstOffset) const {
+		if (snapshot->filled >= snapshot->bufferSize)
+			return (snapshot->bufferSize >> level) + 1;
+		return std::max((int) ((snapshot->filled - firstOffset) / (1 << level)), 0);
+	}
 
-	ScopeDisplay() {
-		font = APP->window->loadFont(asset::system("res/fonts/ShareTechMono-Regular.ttf"));
+	/// reduce a channel to the min and max of each bin of 2^level samples into levelMin and levelMax, in ring order.
+	/// Peak detected traces are reduced from their envelopes, others from the point samples
+	void reduceLevel(const ScopeTrace &trace, int c, int level) {
+		const float *sourceMin = trace.min.allocated ? trace.min[c] : trace.buffer[c];
+		const float *sourceMax = trace.max.allocated ? trace.max[c] : trace.buffer[c];
+		auto bins = snapshot->bufferSize >> level;
+		for (auto j = 0; j < bins; j++) {
+			auto vMin = sourceMin[j << level];
+			auto vMax = sourceMax[j << level];
+			for (auto i = (j << level) + 1; i < (j + 1) << level; i++) {
+				vMin = std::fmin(vMin, sourceMin[i]);
+				vMax = std::fmax(vMax, sourceMax[i]);
+			}
+			levelMin[j] = vMin;
+			levelMax[j] = vMax;
+		}
+	}
+
+	/// transformTrace for a time base trace, reduced to the min and max of each pixel column
+	/// when there are more than two samples per pixel
+	void transformTimeTrace(const ScopeTrace &trace, int c, float offset, float gain, Rect bounds) {
+		auto b = Rect(Vec(0, 15), bounds.size.minus(Vec(0, 15 * 2)));
+		auto bufferSize = snapshot->bufferSize;
+		auto pixels = b.size.x * pixelScale;
+		auto level = 0;
+		while ((bufferSize >> (level + 1)) >= pixels && (bufferSize >> (level + 1)) > 1)
+			level++;
+		if (level == 0) {
+			transformTrace(NULL, 0, 0, trace.buffer[c], offset, gain, bounds);
+			return;
+		}
+
+		reduceLevel(trace, c, level);
+		auto bins = bufferSize >> level;
+		auto binWidth = (float) (1 << level);
+		auto factorY = gain / 2.0f * -b.size.y;
+		auto originY = b.pos.y + b.size.y;
+		auto timeFactor = b.size.x / (bufferSize - 1);
+		// bins are in ring order, start from the one holding the first sample of the sweep.
+		// It straddles the start of the sweep, so it is drawn at both ends
+		auto firstBin = snapshot->viewStart >> level;
+		auto firstOffset = (float) ((firstBin << level) - snapshot->viewStart);
+		auto binCount = filledBins(level, firstOffset);
+		auto lastY = 0.f;
+		for (auto j = 0; j < binCount; j++) {
+			auto m = (firstBin + j) & (bins - 1);
+			auto yMin = (levelMin[m] + offset) * factorY + originY;
+			auto yMax = (levelMax[m] + offset) * factorY + originY;
+			// the extreme nearest the previous bin's comes first, so the line zigzags rather than crosses
+			if (j > 0 && std::fabs(yMax - lastY) < std::fabs(yMin - lastY))
+				std::swap(yMin, yMax);
+			auto x = (firstOffset + j * binWidth) * timeFactor + b.pos.x;
+			vertexX[2 * j] = x + 0.25f * binWidth * timeFactor;
+			vertexY[2 * j] = yMin;
+			vertexX[2 * j + 1] = x + 0.75f * binWidth * timeFactor;
+			vertexY[2 * j + 1] = yMax;
+			lastY = yMax;
+		}
+		vertexCount = 2 * binCount;
+		vertexIndex = std::min(2 * (int) ((snapshot->bufferIndex - firstOffset) / binWidth), vertexCount);
+		vertexGeneration++;
 	}
 
+	/// map the points from transformTrace to those of a kaleidoscope reflection, which drawWaveform used to get
+	/// by mirroring and rotating by 2 * kRotation in data space before scaling to pixels
+	void reflectTrace(float kRotation, Rect bounds) {
+		float m[4];
+		Vec origin;
+		getReflection(kRotation, bounds, m, origin);
+		auto originX = origin.x;
+		auto originY = origin.y;
+		auto xx = m[0];
+		auto yx = m[1];
+		auto xy = m[2];
+		auto yy = m[3];
+		auto i = 0;
+		for (; i + 4 <= vertexCount; i += 4) {
+			auto x = simd::float_4::load(vertexX + i) - originX;
+			auto y = simd::float_4::load(vertexY + i) - originY;
+			(x * xx + y * xy + originX).store(reflectedX + i);
+			(x * yx + y * yy + originY).store(reflectedY + i);
+		}
+		for (; i < vertexCount; i++) {
+			auto x = vertexX[i] - originX;
+			auto y = vertexY[i] - originY;
+			reflectedX[i] = x * xx + y * xy + originX;
+			reflectedY[i] = x * yx + y * yy + originY;
+		}
+	}
+
+	/// the reflection reflectTrace applies, as a column major matrix about origin
+	static void getReflection(float kRotation, Rect bounds, float m[4], Vec &origin) {
+		auto b = Rect(Vec(0, 15), bounds.size.minus(Vec(0, 15 * 2)));
+		auto scaleX = b.pos.y + b.size.y - b.pos.x;
+		auto scaleY = -b.size.y;
+		origin = Vec(b.pos.x, b.pos.y + b.size.y);
+		auto cos2R = std::cos(2.0f * kRotation);
+		auto sin2R = std::sin(2.0f * kRotation);
+		m[0] = -cos2R;
+		m[1] = scaleY * sin2R / scaleX;
+		m[2] = scaleX * sin2R / scaleY;
+		m[3] = cos2R;
+	}
+
+	/// line type after cv, with the coefficients drawWaveform morphs between types with
+	int getLineType(float &normVecCoeff, float &vecExprScale) {
+		auto vectorScale = 0.998f;
+		auto experimentalScale = 0.9f;
+		auto lineTypeValue = module->params[Scope::LINE_TYPE_PARAM].getValue()
+							 + module->inputs[Scope::LINE_TYPE_INPUT].getVoltage();
+		//morph between normal and vector lines
+		normVecCoeff = lineTypeValue - (int) Scope::LineType::NORMAL_LINE;
+		//morph between vector and experimental line types
+		auto vecExprCoeff = lineTypeValue - (int) Scope::LineType::VECTOR_LINE;
+		vecExprScale = vecExprCoeff * (experimentalScale - vectorScale) + vectorScale;
+		return clamp((int) lineTypeValue, 0, (int) Scope::LineType::NUM_LINES - 1);
+	}
+
+	/// drawWaveform with lineRenderer: the same segments, with the fade computed per segment by its shader
+	void strokeWaveform(float kRadius, float kRotation, bool kaleidoscopeReflection, NVGcolor beam, Rect bounds) {
+		if (vertexCount < 2)
+			return;
+		lineRenderer.upload(vertexX, vertexY, vertexCount, vertexGeneration);
+
+		MFTraceRenderer::Stroke stroke;
+		stroke.color[0] = beam.r;
+		stroke.color[1] = beam.g;
+		stroke.color[2] = beam.b;
+		stroke.lineWidth = module->lineWidth;
+		stroke.maxAlpha = 0.99f;
+		stroke.fade = (bool) module->fade;
+
+		// the segments drawWaveform visits, see there
+		auto count = vertexCount;
+		auto startIndex = clamp(stroke.fade ? vertexIndex - 3 : count - 2, 0, count - 1);
+		auto endIndex = clamp(stroke.fade ? vertexIndex - 2 : 0, 1, count - 1);
+		stroke.startStep = startIndex;
+		stroke.stepCount = (startIndex - endIndex + count) % count;
+
+		float normVecCoeff, vecExprScale;
+		switch ((Scope::LineType) getLineType(normVecCoeff, vecExprScale)) {
+			case Scope::LineType::NORMAL_LINE:
+				// the first segment has no previous point to start from
+				stroke.firstStep = 1;
+				stroke.weights[0] = 1.f - normVecCoeff;
+				stroke.weights[1] = normVecCoeff;
+				break;
+			case Scope::LineType::VECTOR_LINE:
+				stroke.weights[0] = 0.f;
+				stroke.weights[1] = vecExprScale;
+				break;
+			default:
+				stroke.weights[0] = 0.f;
+				stroke.weights[1] = 0.9f;
+				break;
+		}
+
+		if (kaleidoscopeReflection) {
+			Vec origin;
+			getReflection(kRotation, bounds, stroke.reflection, origin);
+			stroke.reflectionOffset[0] = origin.x - (stroke.reflection[0] * origin.x + stroke.reflection[2] * origin.y);
+			stroke.reflectionOffset[1] = origin.y - (stroke.reflection[1] * origin.x + stroke.reflection[3] * origin.y);
+		}
+		stroke.translation[0] = kRadius * std::cos(kRotation) + bounds.size.x / 2.0f;
+		stroke.translation[1] = kRadius * std::sin(kRotation) - (bounds.size.y - 30) / 2.0f;
+		if (!(bool) module->params[Scope::LISSAJOUS_PARAM].getValue())
+			stroke.translation[0] -= bounds.size.x / 2.0f;
+
+		auto b = Rect(Vec(0, 15), bounds.size.minus(Vec(0, 15 * 2)));
+		stroke.scissor[0] = b.pos.x;
+		stroke.scissor[1] = b.pos.y;
+		stroke.scissor[2] = b.size.x;
+		stroke.scissor[3] = b.size.y;
+		lineRenderer.draw(stroke);
+	}
+
+	/// stroke the points from transformTrace, or their reflection when kaleidoscopeReflection is set
 	void drawWaveform(const DrawArgs &args,
-					  const float *bufferX,
-					  float offsetX,
-					  float gainX,
-					  const float *bufferY,
-					  float offsetY,
-					  float gainY,
 					  float kRadius = 0.0f,
 					  float kRotation = 0.0f,
+					  bool kaleidoscopeReflection = false,
 					  NVGcolor beam = {1.0f, 1.0f, 1.0f, 1.0f},
 					  Rect bounds = {0, 0, 1, 1}) {
-		assert(bufferY);
+		if (lineRenderer.drawing()) {
+			strokeWaveform(kRadius, kRotation, kaleidoscopeReflection, beam, bounds);
+			return;
+		}
+		// nothing captured yet since a restart
+		if (vertexCount < 2)
+			return;
 		nvgSave(args.vg);
 
 		//beam fading using a varying alpha
 		auto maxAlpha = 0.99f;
-		auto lightInc = maxAlpha / (float) module->bufferSize;
-		auto currentAlpha = maxAlpha;
+		auto lightInc = maxAlpha / (float) vertexCount;
+		auto widthInc = module->lineWidth / (float) vertexCount;
 
-		auto currentLineWidth = module->lineWidth;
-		auto widthInc = module->lineWidth / (float) module->bufferSize;;
+		// segments are batched into one stroke per band of the fade, or one stroke in all without fade.
+		// With no bands every segment is stroked with its own alpha and width
+		auto fading = (bool) module->fade;
+		auto bands = fading ? module->fadeBands : 1;
+		auto band = -1;
+		auto step = 0;
 
 
 		auto b = Rect(Vec(0, 15), bounds.size.minus(Vec(0, 15 * 2)));
@@ -445,107 +1411,607 @@ struct ScopeDisplay : ModuleLightWidget {
 		nvgStrokeWidth(args.vg, module->lineWidth);
 		nvgGlobalCompositeOperation(args.vg, NVG_LIGHTER);
 
-		auto cos2R = simd::cos(2.0f * kRotation);
-		auto sin2R = simd::sin(2.0f * kRotation);
+		const float *pointsX = vertexX;
+		const float *pointsY = vertexY;
+		if (kaleidoscopeReflection) {
+			reflectTrace(kRotation, bounds);
+			pointsX = reflectedX;
+			pointsY = reflectedY;
+		}
+
+		// the line type only changes per frame
+		auto experimentalScale = 0.9f;
+		float normVecCoeff, vecExprScale;
+		auto lType = getLineType(normVecCoeff, vecExprScale);
 
 		// when drawing the buffer, if the line is to fade, start drawing at 2 samples prior
 		// bufferIndex, with full alpha.
 		// when the line is not fading, draw the buffer from end to start to remove flicker.
-		auto startIndex = (bool) module->fade ? module->bufferIndex - 3 : module->bufferSize - 2;
-		startIndex = clamp(startIndex, 0, module->bufferSize - 1);
-		auto endIndex = (bool) module->fade ? module->bufferIndex - 2 : 0;
-		endIndex = clamp(endIndex, 1, module->bufferSize - 1);
+		auto bufferSize = vertexCount;
+		auto startIndex = (bool) module->fade ? vertexIndex - 3 : bufferSize - 2;
+		startIndex = clamp(startIndex, 0, bufferSize - 1);
+		auto endIndex = (bool) module->fade ? vertexIndex - 2 : 0;
+		endIndex = clamp(endIndex, 1, bufferSize - 1);
 
 
-		for (auto i = startIndex; i != endIndex; i--) {
+		for (auto i = startIndex; i != endIndex; i--, step++) {
 			if (i < 0)
-				i = module->bufferSize - 1; // loop buffer due to starting at various locations
+				i = bufferSize - 1; // loop buffer due to starting at various locations
+
+			auto segmentBand = bands > 0 ? step * bands / bufferSize : step;
+			if (segmentBand != band) {
+				if (band >= 0) {
+					nvgStroke(args.vg);
+					nvgBeginPath(args.vg);
+					nvgMoveTo(args.vg, lastCoordinate.x, lastCoordinate.y);
+				}
+				band = segmentBand;
+				// a band is drawn with the alpha and width of the segment in its middle
+				auto fadeStep = 0.f;
+				if (fading)
+					fadeStep = bands > 0 ? (band + 0.5f) * bufferSize / bands : step;
+				nvgStrokeColor(args.vg, nvgRGBAf(beam.r, beam.g, beam.b, maxAlpha - fadeStep * lightInc));
+				nvgStrokeWidth(args.vg, module->lineWidth - fadeStep * widthInc);
+			}
+
+			auto p = Vec(pointsX[i], pointsY[i]);
+			if (i == bufferSize - 1) {
+				nvgMoveTo(args.vg, p.x, p.y);
+			} else {
+				switch ((Scope::LineType) lType) {
+					case Scope::LineType::NORMAL_LINE: {
+						Vec intermediate;
+						intermediate.x = normVecCoeff * (p.x - lastCoordinate.x) + lastCoordinate.x;
+						intermediate.y = normVecCoeff * (p.y - lastCoordinate.y) + lastCoordinate.y;
+						if (i != startIndex)
+							nvgMoveTo(args.vg, intermediate.x, intermediate.y);
+
+						nvgLineTo(args.vg, p.x, p.y);
+						break;
+					}
+					case Scope::LineType::VECTOR_LINE:
+						nvgMoveTo(args.vg, vecExprScale * p.x, vecExprScale * p.y);
+						nvgLineTo(args.vg, p.x, p.y);
+						break;
+					case Scope::LineType::EXPERIMENTAL_LINE:
+						nvgMoveTo(args.vg, experimentalScale * p.x, experimentalScale * p.y);
+						nvgLineTo(args.vg, p.x, p.y);
+						break;
+					case Scope::NUM_LINES:
+						assert(false);
+						break;
+					default:
+						assert(false);
+				}
+			}
+			lastCoordinate = p;
+		}
+		nvgStroke(args.vg);
+		nvgResetTransform(args.vg);
+		nvgResetScissor(args.vg);
+		nvgRestore(args.vg);
+	}
+
+	/// draw a peak detected trace as the area between its min and max, two vertices per bin.
+	/// The bins are sized so there are about as many as screen pixels across
+	void drawEnvelope(const DrawArgs &args,
+					  const ScopeTrace &trace,
+					  int c,
+					  float offset,
+					  float gain,
+					  NVGcolor beam,
+					  Rect bounds) {
+		nvgSave(args.vg);
+		auto b = Rect(Vec(0, 15), bounds.size.minus(Vec(0, 15 * 2)));
+		nvgScissor(args.vg, b.pos.x, b.pos.y, b.size.x, b.size.y);
+		nvgTranslate(args.vg, 0, -(bounds.size.y - 30) / 2.0f);
+		nvgGlobalCompositeOperation(args.vg, NVG_LIGHTER);
+
+		auto bufferSize = snapshot->bufferSize;
+		auto level = 0;
+		while ((bufferSize >> (level + 1)) >= b.size.x * pixelScale && (bufferSize >> (level + 1)) > 1)
+			level++;
+		const float *minBuffer = trace.min[c];
+		const float *maxBuffer = trace.max[c];
+		if (level > 0) {
+			reduceLevel(trace, c, level);
+			minBuffer = levelMin;
+			maxBuffer = levelMax;
+		}
+		auto bins = bufferSize >> level;
+		auto binWidth = (float) (1 << level);
+		// bins are in ring order, start from the one holding the first sample of the sweep.
+		// It straddles the start of the sweep, so it is drawn at both ends
+		auto firstBin = snapshot->viewStart >> level;
+		auto firstOffset = (float) ((firstBin << level) - snapshot->viewStart);
+		auto binCount = filledBins(level, firstOffset);
+		if (binCount < 1) {
+			nvgRestore(args.vg);
+			return;
+		}
+
+		nvgBeginPath(args.vg);
+		for (auto j = 0; j < binCount; j++) {
+			auto m = (firstBin + j) & (bins - 1);
+			auto t = (firstOffset + (j + 0.5f) * binWidth - 0.5f) / (bufferSize - 1);
+			auto x = rescale(t, 0.f, 1.f, b.pos.x, b.pos.x + b.size.x);
+			auto y = rescale((maxBuffer[m] + offset) * gain / 2.0f, 0.f, 1.f, b.pos.y + b.size.y, b.pos.y);
+			if (j == 0)
+				nvgMoveTo(args.vg, x, y);
+			else
+				nvgLineTo(args.vg, x, y);
+		}
+		for (auto j = binCount - 1; j >= 0; j--) {
+			auto m = (firstBin + j) & (bins - 1);
+			auto t = (firstOffset + (j + 0.5f) * binWidth - 0.5f) / (bufferSize - 1);
+			auto x = rescale(t, 0.f, 1.f, b.pos.x, b.pos.x + b.size.x);
+			auto y = rescale((minBuffer[m] + offset) * gain / 2.0f, 0.f, 1.f, b.pos.y + b.size.y, b.pos.y);
+			nvgLineTo(args.vg, x, y);
+		}
+		nvgClosePath(args.vg);
+		nvgFillColor(args.vg, nvgTransRGBAf(beam, 0.5f));
+		nvgFill(args.vg);
+		// the outline keeps the trace visible where min and max are equal
+		nvgLineJoin(args.vg, NVG_BEVEL);
+		nvgStrokeWidth(args.vg, module->lineWidth);
+		nvgStrokeColor(args.vg, beam);
+		nvgStroke(args.vg);
+
+		nvgResetTransform(args.vg);
+		nvgResetScissor(args.vg);
+		nvgRestore(args.vg);
+	}
 
-			nvgStrokeColor(args.vg, nvgRGBAf(beam.r, beam.g, beam.b, currentAlpha));
-			nvgStrokeWidth(args.vg, currentLineWidth);
-			if ((bool) module->fade) {
-				currentAlpha -= lightInc;
-				currentLineWidth -= widthInc;
+	/// hand the whole ring of each new snapshot to the spectrum thread.
+	/// The ring always holds the newest bufferSize samples, whether or not a sweep is complete
+	void submitSpectrum() {
+		if (!spectrum)
+			spectrum.reset(new MFSpectrum());
+		if (snapshot->generation == spectrumGeneration)
+			return;
+		spectrumGeneration = snapshot->generation;
+		spectrum->submit(0, snapshot->traceX.buffer.block, snapshot->traceX.channels, snapshot->writeIndex,
+						 snapshot->bufferSize, module->spectrumSize, module->spectrumOverlap);
+		spectrum->submit(1, snapshot->traceY.buffer.block, snapshot->traceY.channels, snapshot->writeIndex,
+						 snapshot->bufferSize, module->spectrumSize, module->spectrumOverlap);
+	}
+
+	/// draw the magnitude of each channel from -80dB to +20dB, the loudest bin in each pixel column
+	void drawSpectrum(const DrawArgs &args, const MFSpectrum::Result &result, NVGcolor beam, Rect bounds) {
+		if (result.bins < 2)
+			return;
+		nvgSave(args.vg);
+		auto b = Rect(Vec(0, 15), bounds.size.minus(Vec(0, 15 * 2)));
+		nvgScissor(args.vg, b.pos.x, b.pos.y, b.size.x, b.size.y);
+		nvgGlobalCompositeOperation(args.vg, NVG_LIGHTER);
+		nvgLineJoin(args.vg, NVG_BEVEL);
+		nvgStrokeWidth(args.vg, module->lineWidth);
+		nvgStrokeColor(args.vg, beam);
+
+		// the log axis starts from the first bin above DC
+		auto logFrequency = module->spectrumLogFrequency;
+		auto firstBin = logFrequency ? 1 : 0;
+		auto logSpan = std::log((float) (result.bins - 1));
+		for (auto c = 0; c < result.channels; c++) {
+			const float *magnitudes = &result.magnitudes[c * result.bins];
+			nvgBeginPath(args.vg);
+			auto column = -1;
+			auto columnMax = -INFINITY;
+			auto first = true;
+			for (auto k = firstBin; k <= result.bins; k++) {
+				auto x = 0.f;
+				if (k < result.bins) {
+					auto t = logFrequency ? std::log((float) k) / logSpan : (float) k / (result.bins - 1);
+					x = rescale(t, 0.f, 1.f, b.pos.x, b.pos.x + b.size.x);
+				}
+				// emit the column just finished once a bin lands in a new one, or at the end
+				if (k == result.bins || (int) x != column) {
+					if (column >= 0) {
+						auto y = rescale(columnMax, -80.f, 20.f, b.pos.y + b.size.y, b.pos.y);
+						if (first)
+							nvgMoveTo(args.vg, column, y);
+						else
+							nvgLineTo(args.vg, column, y);
+						first = false;
+					}
+					column = (int) x;
+					columnMax = -INFINITY;
+				}
+				if (k < result.bins)
+					columnMax = std::fmax(columnMax, magnitudes[k]);
 			}
+			nvgStroke(args.vg);
+		}
+
+		nvgResetScissor(args.vg);
+		nvgRestore(args.vg);
+	}
+
+	void getScaling(float &gainX, float &offsetX, float &gainY, float &offsetY) {
+		gainX = std::pow(2.f, module->params[Scope::X_SCALE_PARAM].getValue()) / 10.0f;
+		gainX += module->inputs[Scope::X_SCALE_INPUT].getVoltage() / 10.0f;
+		gainY = std::pow(2.f, module->params[Scope::Y_SCALE_PARAM].getValue()) / 10.0f;
+		gainY += module->inputs[Scope::Y_SCALE_INPUT].getVoltage() / 10.0f;
+		offsetX = module->params[Scope::X_POS_PARAM].getValue();
+		offsetX += module->inputs[Scope::X_POS_INPUT].getVoltage();
+		offsetY = module->params[Scope::Y_POS_PARAM].getValue();
+		offsetY += module->inputs[Scope::Y_POS_INPUT].getVoltage();
+	}
+
+	bool phosphorActive() {
+		return module->persistence != 0.f && module->plotType != Scope::PlotType::SPECTRUM && !kaleidoscopeActive();
+	}
+
+	/// bump the cache's parameterGeneration if anything the trace layer is drawn with has changed
+	void updateParameterGeneration(TraceCache &cache, Rect bounds, float pixelRatio) {
+		// compared in place, so nothing is allocated on frames where nothing changed
+		auto n = 0;
+		auto changed = false;
+		auto compare = [&](double value) {
+			if (cache.parameters[n] != value) {
+				cache.parameters[n] = value;
+				changed = true;
+			}
+			n++;
+		};
+		for (auto &param : module->params)
+			compare(param.getValue());
+		for (auto input : {Scope::X_SCALE_INPUT, Scope::X_POS_INPUT, Scope::Y_SCALE_INPUT, Scope::Y_POS_INPUT,
+						   Scope::TRIG_LEVEL_INPUT, Scope::LINE_TYPE_INPUT, Scope::KALEIDOSCOPE_COLOR_SPREAD_INPUT})
+			compare(module->inputs[input].getVoltage());
+		compare(module->hue);
+		compare(module->lineWidth);
+		compare(module->kaleidoscope.count);
+		compare(module->kaleidoscope.radius);
+		compare(module->plotType);
+		compare(module->fadeBands);
+		compare(module->preTrigger);
+		compare(module->spectrumLogFrequency);
+		compare(module->gpuLines);
+		compare(bounds.size.x);
+		compare(bounds.size.y);
+		compare(pixelRatio);
+		auto showSpectrum = spectrum && module->plotType == Scope::PlotType::SPECTRUM;
+		compare(showSpectrum ? spectrum->read(0).sequence : 0);
+		compare(showSpectrum ? spectrum->read(1).sequence : 0);
+		assert(n <= (int) cache.parameters.size());
+		if (changed)
+			cache.parameterGeneration++;
+	}
+
+	/// draw anything that is rendered offscreen, outside of a nanovg frame on vg.
+	/// The trace layer is redrawn into its cache only when its generations have moved on
+	void renderOffscreen(NVGcontext *vg, Rect bounds, float pixelRatio) {
+		pixelScale = pixelRatio;
+		auto &cache = traceCache;
+		if (phosphorActive()) {
+			cache.framebuffer.release();
+			cache.valid = false;
+			renderKaleidoscope(vg, bounds, pixelRatio);
+			renderPhosphor(vg, bounds, pixelRatio);
+			return;
+		}
+
+		auto parameterGeneration = cache.parameterGeneration;
+		updateParameterGeneration(cache, bounds, pixelRatio);
+		snapshot = &readSnapshot();
+		auto width = (int) std::ceil(bounds.size.x * pixelRatio);
+		auto height = (int) std::ceil(bounds.size.y * pixelRatio);
+		if (width <= 0 || height <= 0)
+			return;
+		auto created = cache.framebuffer.reserve(vg, width, height);
+		if (!cache.framebuffer.fb) {
+			cache.valid = false;
+			return;
+		}
+		if (cache.valid && !created && cache.generation == snapshot->generation
+			&& cache.parameterGeneration == parameterGeneration)
+			return;
+
+		renderKaleidoscope(vg, bounds, pixelRatio);
+		renderPhosphor(vg, bounds, pixelRatio);
+		cache.framebuffer.begin(bounds.size, pixelRatio, true);
+		DrawArgs framebufferArgs;
+		framebufferArgs.vg = vg;
+		beginLines(bounds.size, pixelRatio);
+		preDrawWaveforms(framebufferArgs, Rect(Vec(), bounds.size));
+		lineRenderer.end();
+		cache.framebuffer.end();
+		cache.generation = snapshot->generation;
+		cache.valid = true;
+	}
+
+	/// draw the traces of an offscreen pass with lineRenderer, if it is turned on and works.
+	/// GL draws straight away while nanovg waits for the end of the frame, which is fine as
+	/// traces are added to what's beneath and are drawn before anything else
+	void beginLines(Vec size, float pixelRatio) {
+		if (module->gpuLines)
+			lineRenderer.begin(size.x, size.y, pixelRatio);
+	}
+
+	/// draw the trace layer from its cache if there is one, otherwise directly
+	void drawTraces(const DrawArgs &args, Rect bounds) {
+		auto &cache = traceCache;
+		if (!cache.valid || !cache.framebuffer.fb) {
+			preDrawWaveforms(args, bounds);
+			return;
+		}
+		nvgSave(args.vg);
+		nvgGlobalCompositeOperation(args.vg, NVG_LIGHTER);
+		auto paint = nvgImagePattern(args.vg, 0, 0, bounds.size.x, bounds.size.y, 0, cache.framebuffer.fb->image, 1.f);
+		nvgBeginPath(args.vg);
+		nvgRect(args.vg, 0, 0, bounds.size.x, bounds.size.y);
+		nvgFillPaint(args.vg, paint);
+		nvgFill(args.vg);
+		nvgRestore(args.vg);
+	}
+
+	/// fade the phosphor framebuffer by the time since the last frame, and add the new part of the sweep
+	void renderPhosphor(NVGcontext *vg, Rect bounds, float pixelRatio) {
+		auto &state = phosphor;
+		if (!phosphorActive()) {
+			state.framebuffer.release();
+			return;
+		}
+		auto width = (int) std::ceil(bounds.size.x * pixelRatio);
+		auto height = (int) std::ceil(bounds.size.y * pixelRatio);
+		if (width <= 0 || height <= 0)
+			return;
+		auto created = state.framebuffer.reserve(vg, width, height);
+		if (!state.framebuffer.fb)
+			return;
+
+		// carry on from the last segment drawn if the sweep is the same, otherwise draw the new one from the start
+		snapshot = &readSnapshot();
+		auto sweepStart = snapshot->written - snapshot->bufferIndex;
+		auto from = 0;
+		if (!created && sweepStart == state.sweepStart && snapshot->layout == state.layout)
+			from = std::max(state.drawnIndex - 1, 0);
+		auto to = snapshot->bufferIndex;
+		state.sweepStart = sweepStart;
+		state.layout = snapshot->layout;
+		state.drawnIndex = to;
+
+		auto time = glfwGetTime();
+		if (created)
+			state.decay = 1.f;
+		else if (module->persistence > 0.f)
+			state.decay *= std::pow(0.5f, (float) (time - state.time) / module->persistence);
+		state.time = time;
+
+		state.framebuffer.begin(bounds.size, pixelRatio, created);
+		// The framebuffer has 8 bits per channel, and scaling by a decay close to 1 rounds back to the same value.
+		// So the decay builds up until it takes at least a step off the brightest value. Dim values that scaling
+		// can't move at all are taken down a step each time as well, or they would never fade out
+		if (state.decay <= 254.f / 255.f) {
+			nvgBeginPath(vg);
+			nvgRect(vg, 0, 0, bounds.size.x, bounds.size.y);
+			nvgGlobalCompositeBlendFunc(vg, NVG_ZERO, NVG_SRC_ALPHA);
+			nvgFillColor(vg, nvgRGBAf(0.f, 0.f, 0.f, state.decay));
+			nvgFill(vg);
+			nvgEndFrame(vg);
+			// nanovg has no blend equation of its own, the subtraction needs the frame flushed around it
+			glBlendEquation(GL_FUNC_REVERSE_SUBTRACT);
+			nvgBeginFrame(vg, bounds.size.x, bounds.size.y, pixelRatio);
+			nvgBeginPath(vg);
+			nvgRect(vg, 0, 0, bounds.size.x, bounds.size.y);
+			nvgGlobalCompositeBlendFunc(vg, NVG_ONE, NVG_ONE);
+			// premultiplied, a step of 1/255 on every channel
+			nvgFillColor(vg, nvgRGBA(0xff, 0xff, 0xff, 1));
+			nvgFill(vg);
+			nvgEndFrame(vg);
+			glBlendEquation(GL_FUNC_ADD);
+			nvgBeginFrame(vg, bounds.size.x, bounds.size.y, pixelRatio);
+			state.decay = 1.f;
+		}
+
+		float gainX, offsetX, gainY, offsetY;
+		getScaling(gainX, offsetX, gainY, offsetY);
+		DrawArgs framebufferArgs;
+		framebufferArgs.vg = vg;
+		auto traceBounds = Rect(Vec(), bounds.size);
+		auto &traceX = snapshot->traceX;
+		auto &traceY = snapshot->traceY;
+		if ((bool) module->params[Scope::LISSAJOUS_PARAM].getValue()) {
+			static const float silence[MAX_BUFFER_SIZE] = {};
+			auto lissajousChannels = std::max(traceX.channels, traceY.channels);
+			for (auto c = 0; c < lissajousChannels; c++) {
+				drawTraceSection(framebufferArgs,
+								 c < traceX.channels ? traceX.buffer[c] : silence,
+								 offsetX,
+								 gainX,
+								 c < traceY.channels ? traceY.buffer[c] : silence,
+								 offsetY,
+								 gainY,
+								 from,
+								 to,
+								 nvgHSL(module->hue, 0.5f, 0.5f),
+								 traceBounds);
+			}
+		} else {
+			for (auto c = 0; c < traceY.channels; c++) {
+				drawTraceSection(framebufferArgs, NULL, 0, 0, traceY.buffer[c], offsetY, gainY, from, to,
+								 nvgRGBA(0xe1, 0x02, 0x78, 0xc0), traceBounds);
+			}
+			for (auto c = 0; c < traceX.channels; c++) {
+				drawTraceSection(framebufferArgs, NULL, 0, 0, traceX.buffer[c], offsetX, gainX, from, to,
+								 nvgHSLA(module->hue, 0.5f, 0.5f, 200), traceBounds);
+			}
+		}
+		state.framebuffer.end();
+	}
+
+	/// draw positions [from, to) of the sweep as a single stroke, placed the way drawWaveform places them
+	/// without kaleidoscope. Line type and fade don't apply
+	void drawTraceSection(const DrawArgs &args,
+						  const float *bufferX,
+						  float offsetX,
+						  float gainX,
+						  const float *bufferY,
+						  float offsetY,
+						  float gainY,
+						  int from,
+						  int to,
+						  NVGcolor beam,
+						  Rect bounds) {
+		if (to - from < 2)
+			return;
+		auto lissajous = (bool) module->params[Scope::LISSAJOUS_PARAM].getValue();
+		auto bufferSize = snapshot->bufferSize;
+
+		nvgSave(args.vg);
+		auto b = Rect(Vec(0, 15), bounds.size.minus(Vec(0, 15 * 2)));
+		nvgScissor(args.vg, b.pos.x, b.pos.y, b.size.x, b.size.y);
+		nvgTranslate(args.vg, bounds.size.x / 2.0f, -(bounds.size.y - 30) / 2.0f);
+		if (!lissajous)
+			nvgTranslate(args.vg, -bounds.size.x / 2.0f, 0);
+		nvgGlobalCompositeOperation(args.vg, NVG_LIGHTER);
+
+		nvgBeginPath(args.vg);
+		for (auto i = from; i < to; i++) {
+			auto r = snapshot->ringIndex(i);
 			Vec v;
 			if (bufferX) {
-				v.x = (bufferX[i] + offsetX) * gainX / 2.0f;
+				v.x = (bufferX[r] + offsetX) * gainX / 2.0f;
 			} else {
-				v.x = (float) i / (module->bufferSize - 1);
+				v.x = (float) i / (bufferSize - 1);
 			}
-			v.y = (bufferY[i] + offsetY) * gainY / 2.0f;
+			v.y = (bufferY[r] + offsetY) * gainY / 2.0f;
+
+			Vec p;
+			if (lissajous)
+				p.x = rescale(v.x, 0.f, 1.f, b.pos.x, b.pos.y + b.size.y);
+			else
+				p.x = rescale(v.x, 0.f, 1.f, b.pos.x, b.pos.x + b.size.x);
+			p.y = rescale(v.y, 0.f, 1.f, b.pos.y + b.size.y, b.pos.y);
+			if (i == from)
+				nvgMoveTo(args.vg, p.x, p.y);
+			else
+				nvgLineTo(args.vg, p.x, p.y);
+		}
+		nvgStrokeWidth(args.vg, module->lineWidth);
+		nvgStrokeColor(args.vg, beam);
+		nvgStroke(args.vg);
+		nvgRestore(args.vg);
+	}
+
+	void compositePhosphor(const DrawArgs &args, const MFFramebuffer &framebuffer, Rect bounds) {
+		nvgSave(args.vg);
+		nvgGlobalCompositeOperation(args.vg, NVG_LIGHTER);
+		auto paint = nvgImagePattern(args.vg, 0, 0, bounds.size.x, bounds.size.y, 0, framebuffer.fb->image, 1.f);
+		nvgBeginPath(args.vg);
+		nvgRect(args.vg, 0, 0, bounds.size.x, bounds.size.y);
+		nvgFillPaint(args.vg, paint);
+		nvgFill(args.vg);
+		nvgRestore(args.vg);
+	}
 
-			//rotate 2 * kRotate
+	bool kaleidoscopeActive() {
+		return (bool) module->params[Scope::LISSAJOUS_PARAM].getValue()
+			   && (bool) module->params[Scope::KALEIDOSCOPE_USE_PARAM].getValue();
+	}
 
-			auto xNew = v.x * cos2R + v.y * sin2R;
-			v.y = -v.x * sin2R + v.y * cos2R;
-			v.x = xNew;
+	/// draw the base kaleidoscope trace of every channel into its framebuffer, in white so it can be tinted
+	/// when composited. Must be called outside of a nanovg frame on vg
+	void renderKaleidoscope(NVGcontext *vg, Rect bounds, float pixelRatio) {
+		auto &framebuffer = kaleidoscopeFramebuffer;
+		if (!kaleidoscopeActive()) {
+			framebuffer.release();
+			return;
+		}
+		auto width = (int) std::ceil(bounds.size.x * pixelRatio);
+		auto height = (int) std::ceil(bounds.size.y * pixelRatio);
+		if (width <= 0 || height <= 0)
+			return;
+		framebuffer.reserve(vg, width, height);
+		if (!framebuffer.fb)
+			return;
 
-			Vec p;
-			// resize x & y by height, to keep plots in correct ratio if Lissajous
-			if ((bool) module->params[Scope::LISSAJOUS_PARAM].getValue())
-				p.x = rescale(v.x, 0.f, 1.f, b.pos.x, b.pos.y + b.size.y);
-			else
-				p.x = rescale(v.x, 0.f, 1.f, b.pos.x, b.pos.x + b.size.x);
+		snapshot = &readSnapshot();
+		float gainX, offsetX, gainY, offsetY;
+		getScaling(gainX, offsetX, gainY, offsetY);
+
+		framebuffer.begin(bounds.size, pixelRatio, true);
+		DrawArgs framebufferArgs;
+		framebufferArgs.vg = vg;
+		beginLines(bounds.size, pixelRatio);
+		static const float silence[MAX_BUFFER_SIZE] = {};
+		auto &traceX = snapshot->traceX;
+		auto &traceY = snapshot->traceY;
+		auto lissajousChannels = std::max(traceX.channels, traceY.channels);
+		for (auto c = 0; c < lissajousChannels; c++) {
+			transformTrace(c < traceX.channels ? traceX.buffer[c] : silence,
+						   offsetX,
+						   gainX,
+						   c < traceY.channels ? traceY.buffer[c] : silence,
+						   offsetY,
+						   gainY,
+						   Rect(Vec(), bounds.size));
+			drawWaveform(framebufferArgs, 0, 0, false, nvgRGBAf(1.f, 1.f, 1.f, 1.f), Rect(Vec(), bounds.size));
+		}
+		lineRenderer.end();
+		framebuffer.end();
+	}
 
-			p.y = rescale(v.y, 0.f, 1.f, b.pos.y + b.size.y, b.pos.y);
-			if (i == module->bufferSize - 1) {
-				nvgMoveTo(args.vg, p.x, p.y);
-				lastCoordinate = p;
-			} else {
-				auto vectorScale = 0.998f;
-				auto experimentalScale = 0.9f;
-				auto lType = (int) (module->params[Scope::LINE_TYPE_PARAM].getValue()
-									+ module->inputs[Scope::LINE_TYPE_INPUT].getVoltage());
-				lType = clamp(lType, 0, (int) Scope::LineType::NUM_LINES - 1);
-				switch ((Scope::LineType) lType) {
-					case Scope::LineType::NORMAL_LINE: {
-						//morph between normal and vector lines
-						auto normVecCoeff = (module->params[Scope::LINE_TYPE_PARAM].getValue()
-											 + module->inputs[Scope::LINE_TYPE_INPUT].getVoltage())
-											- (int) Scope::LineType::NORMAL_LINE;
-						Vec intermediate;
-						intermediate.x = normVecCoeff * (p.x - lastCoordinate.x) + lastCoordinate.x;
-						intermediate.y = normVecCoeff * (p.y - lastCoordinate.y) + lastCoordinate.y;
-						if (i != startIndex)
-							nvgMoveTo(args.vg, intermediate.x, intermediate.y);
+	/// draw the base trace and its reflections as one textured quad each.
+	/// drawWaveform mirrors and rotates a reflection in data space and then scales it to pixels about the
+	/// centre, so the same mapping is applied to the base trace's pixels here
+	void compositeKaleidoscope(const DrawArgs &args, const MFFramebuffer &framebuffer, Rect bounds) {
+		auto size = bounds.size;
+		auto b = Rect(Vec(0, 15), size.minus(Vec(0, 15 * 2)));
+		auto scaleX = b.pos.y + b.size.y - b.pos.x;
+		auto scaleY = -b.size.y;
+		auto centre = size.div(2.f);
+
+		auto count = module->kaleidoscope.count;
+		auto unitRotation = (float) (2.0 * M_PI) / (float) count;
+		auto unitHueChange = (module->params[Scope::KALEIDOSCOPE_COLOR_SPREAD_PARAM].getValue()
+							  + module->inputs[Scope::KALEIDOSCOPE_COLOR_SPREAD_INPUT].getVoltage() / 5.0)
+							 / count;
 
-						nvgLineTo(args.vg, p.x, p.y);
-						break;
-					}
-					case Scope::LineType::VECTOR_LINE: {
-						//morph between vector and experimental line types
-						auto vecExprCoeff = (module->params[Scope::LINE_TYPE_PARAM].getValue()
-											 + module->inputs[Scope::LINE_TYPE_INPUT].getVoltage())
-											- (int) Scope::LineType::VECTOR_LINE;
-						auto scale = vecExprCoeff * (experimentalScale - vectorScale) + vectorScale;
-
-						nvgMoveTo(args.vg, scale * p.x, scale * p.y);
-						nvgLineTo(args.vg, p.x, p.y);
-						break;
-					}
-					case Scope::LineType::EXPERIMENTAL_LINE:
-						nvgMoveTo(args.vg, experimentalScale * p.x, experimentalScale * p.y);
-						nvgLineTo(args.vg, p.x, p.y);
-						break;
-					case Scope::NUM_LINES:
-						assert(false);
-						break;
-					default:
-						assert(false);
-				}
-				lastCoordinate = p;
+		nvgSave(args.vg);
+		nvgGlobalCompositeOperation(args.vg, NVG_LIGHTER);
+		// -1 is the base trace
+		for (auto i = -1; i < count; i++) {
+			float t[6] = {1.f, 0.f, 0.f, 1.f, 0.f, 0.f};
+			auto hue = module->hue;
+			if (i >= 0) {
+				auto rotation = i * unitRotation;
+				auto cos2R = std::cos(2.0f * rotation);
+				auto sin2R = std::sin(2.0f * rotation);
+				t[0] = -cos2R;
+				t[1] = scaleY * sin2R / scaleX;
+				t[2] = scaleX * sin2R / scaleY;
+				t[3] = cos2R;
+				t[4] = centre.x + module->kaleidoscope.radius * std::cos(rotation) - (t[0] * centre.x + t[2] * centre.y);
+				t[5] = centre.y + module->kaleidoscope.radius * std::sin(rotation) - (t[1] * centre.x + t[3] * centre.y);
+				hue = std::fmod(module->hue + (i + 1) * unitHueChange, 1.0f);
 			}
-			nvgStroke(args.vg);
+			nvgSave(args.vg);
+			nvgScissor(args.vg, b.pos.x, b.pos.y, b.size.x, b.size.y);
+			nvgTransform(args.vg, t[0], t[1], t[2], t[3], t[4], t[5]);
+			auto paint = nvgImagePattern(args.vg, 0, 0, size.x, size.y, 0, framebuffer.fb->image, 1.f);
+			paint.innerColor = paint.outerColor = nvgHSL(hue, 0.5f, 0.5f);
 			nvgBeginPath(args.vg);
-			nvgMoveTo(args.vg, p.x, p.y);
-			lastCoordinate = p;
+			nvgRect(args.vg, 0, 0, size.x, size.y);
+			nvgFillPaint(args.vg, paint);
+			nvgFill(args.vg);
+			nvgRestore(args.vg);
 		}
-		nvgResetTransform(args.vg);
-		nvgResetScissor(args.vg);
 		nvgRestore(args.vg);
 	}
 
+	/// mark where the trigger falls in the sweep, position is from 0 to 1 across
+	void drawTrigTime(const DrawArgs &args, float position, Rect bounds) {
+		auto b = Rect(Vec(0, 15), bounds.size.minus(Vec(0, 15 * 2)));
+		auto x = rescale(position, 0.f, 1.f, b.pos.x, b.pos.x + b.size.x);
+		nvgStrokeColor(args.vg, nvgRGBA(0xff, 0xff, 0xff, 0x10));
+		nvgBeginPath(args.vg);
+		nvgMoveTo(args.vg, x, b.pos.y);
+		nvgLineTo(args.vg, x, b.pos.y + b.size.y);
+		nvgStroke(args.vg);
+	}
+
 	void drawTrig(const DrawArgs &args, float value, Rect bounds) {
 		auto b = Rect(Vec(0, 15), bounds.size.minus(Vec(0, 15 * 2)));
 		nvgScissor(args.vg, b.pos.x, b.pos.y, b.size.x, b.size.y);
@@ -583,7 +2049,8 @@ struct ScopeDisplay : ModuleLightWidget {
 		nvgResetScissor(args.vg);
 	}
 
-	void drawStats(const DrawArgs &args, Vec pos, const char *title, Stats *stats) {
+	void drawStats(const DrawArgs &args, Vec pos, const char *title, const ScopeStats &stats,
+				   const MFMeasurement::Result &measured, float measuredOffset) {
 		nvgFontSize(args.vg, 13);
 		nvgFontFaceId(args.vg, font->handle);
 		nvgTextLetterSpacing(args.vg, -2);
@@ -594,16 +2061,55 @@ struct ScopeDisplay : ModuleLightWidget {
 		nvgFillColor(args.vg, nvgRGBA(0xff, 0xff, 0xff, 0x80));
 		pos = pos.plus(Vec(22, 11));
 
+		auto vpp = stats.vMax - stats.vMin;
 		std::string text;
 		text = "pp ";
-		text += isNear(stats->vpp, 0.f, 100.f) ? string::f("% 6.2f", stats->vpp) : "  ---";
+		text += isNear(vpp, 0.f, 100.f) ? string::f("% 6.2f", vpp) : "  ---";
 		nvgText(args.vg, pos.x, pos.y, text.c_str(), NULL);
 		text = "max ";
-		text += isNear(stats->vMax, 0.f, 100.f) ? string::f("% 6.2f", stats->vMax) : "  ---";
+		text += isNear(stats.vMax, 0.f, 100.f) ? string::f("% 6.2f", stats.vMax) : "  ---";
 		nvgText(args.vg, pos.x + 58 * 1, pos.y, text.c_str(), NULL);
 		text = "min ";
-		text += isNear(stats->vMin, 0.f, 100.f) ? string::f("% 6.2f", stats->vMin) : "  ---";
+		text += isNear(stats.vMin, 0.f, 100.f) ? string::f("% 6.2f", stats.vMin) : "  ---";
+		nvgText(args.vg, pos.x + 58 * 2, pos.y, text.c_str(), NULL);
+		text = "dc ";
+		text += isNear(stats.mean, 0.f, 100.f) ? string::f("% 6.2f", stats.mean) : "  ---";
+		nvgText(args.vg, pos.x + 58 * 3, pos.y, text.c_str(), NULL);
+		text = "rms ";
+		text += isNear(stats.rms, 0.f, 100.f) ? string::f("% 6.2f", stats.rms) : "  ---";
+		nvgText(args.vg, pos.x + 58 * 4, pos.y, text.c_str(), NULL);
+
+		pos.y += measuredOffset;
+		text = "freq ";
+		text += measured.valid ? string::f("%.4gHz", measured.frequency) : "  ---";
+		nvgText(args.vg, pos.x, pos.y, text.c_str(), NULL);
+		text = "period ";
+		text += measured.valid ? string::f("%.4gms", measured.period * 1000.f) : "  ---";
 		nvgText(args.vg, pos.x + 58 * 2, pos.y, text.c_str(), NULL);
+		text = "duty ";
+		text += measured.valid ? string::f("%.0f%%", measured.duty * 100.f) : "  ---";
+		nvgText(args.vg, pos.x + 58 * 4, pos.y, text.c_str(), NULL);
+	}
+
+	/// hand each new complete sweep of the channels in the stats to the measurement thread
+	void submitMeasurement(int channel) {
+		if (!measurement)
+			measurement.reset(new MFMeasurement());
+		if (snapshot->generation == measuredGeneration || snapshot->bufferIndex < snapshot->bufferSize)
+			return;
+		measuredGeneration = snapshot->generation;
+		// with all channels selected the first one is measured, a missing channel clears the result
+		channel = std::max(channel, 0);
+		if (channel < snapshot->traceX.channels)
+			measurement->submit(0, snapshot->traceX.buffer[channel], snapshot->viewStart, snapshot->bufferSize,
+								snapshot->samplePeriod);
+		else
+			measurement->submit(0, nullptr, 0, 0, 0.f);
+		if (channel < snapshot->traceY.channels)
+			measurement->submit(1, snapshot->traceY.buffer[channel], snapshot->viewStart, snapshot->bufferSize,
+								snapshot->samplePeriod);
+		else
+			measurement->submit(1, nullptr, 0, 0, 0.f);
 	}
 
 	void drawLabels(const DrawArgs &args) {
@@ -623,25 +2129,59 @@ struct ScopeDisplay : ModuleLightWidget {
 		}
 	}
 
+	void step() override {
+		// offscreen rendering has to happen outside of the frame being drawn, see draw
+		if (module && !externalWindow && !drawn) {
+			traceCache.valid = false;
+		} else if (module && !externalWindow) {
+			int winWidth, winHeight;
+			int fbWidth, fbHeight;
+			glfwGetWindowSize(APP->window->win, &winWidth, &winHeight);
+			glfwGetFramebufferSize(APP->window->win, &fbWidth, &fbHeight);
+			devicePixelRatio = winWidth > 0 ? (float) fbWidth / (float) winWidth : 1.f;
+			renderOffscreen(APP->window->vg, box, drawScale * devicePixelRatio);
+		}
+		drawn = false;
+		ModuleLightWidget::step();
+	}
+
+	/// release the framebuffers made in vg, before the context goes away.
+	/// A display only ever draws into one GL context, the pop-out window has a display of its own
+	void releaseFramebuffers() {
+		kaleidoscopeFramebuffer.release();
+		phosphor.framebuffer.release();
+		traceCache.framebuffer.release();
+		traceCache.valid = false;
+		lineRenderer.release();
+	}
+
 	void draw(const DrawArgs &args) override {
 		if (!module)
 			return;
 
+		float xform[6];
+		nvgCurrentTransform(args.vg, xform);
+		drawScale = std::hypot(xform[0], xform[1]);
+		pixelScale = drawScale * devicePixelRatio;
+
 		// only display woweform in widget if the external window
 		// is not open. The external window is drawn from ScopeWidget::step
 		// where additional comments are found
-		if (!externalWindow)
-			preDrawWaveforms(args, box);
+		if (!externalWindow) {
+			drawTraces(args, box);
+			drawn = true;
+		}
 
-		// Calculate and draw stats
+		// Draw stats, they are calculated by the module as the samples are captured
 		if ((bool) module->params[Scope::SHOW_STATS_PARAM].getValue()) {
-			if (++statsFrame >= 4) {
-				statsFrame = 0;
-				statsX.calculate(module->bufferX[0], module->channelsX);
-				statsY.calculate(module->bufferY[0], module->channelsY);
-			}
-			drawStats(args, Vec(25, 0), "X", &statsX);
-			drawStats(args, Vec(25, box.size.y - 15), "Y", &statsY);
+			snapshot = &readSnapshot();
+			auto channel = module->statsChannel;
+			submitMeasurement(channel);
+			drawStats(args, Vec(25, 0), "X", selectStats(snapshot->statsX, snapshot->traceX.channels, channel),
+					  measurement->result(0), 13);
+			drawStats(args, Vec(25, box.size.y - 15), "Y",
+					  selectStats(snapshot->statsY, snapshot->traceY.channels, channel),
+					  measurement->result(1), -13);
 		}
 
 		if ((bool) module->params[Scope::SHOW_LABELS_PARAM].getValue()) {
@@ -652,31 +2192,35 @@ struct ScopeDisplay : ModuleLightWidget {
 	}
 
 	void preDrawWaveforms(const DrawArgs &args, Rect bounds) {
-		auto gainX = std::pow(2.f, module->params[Scope::X_SCALE_PARAM].getValue()) / 10.0f;
-		gainX += module->inputs[Scope::X_SCALE_INPUT].getVoltage() / 10.0f;
-		auto gainY = std::pow(2.f, module->params[Scope::Y_SCALE_PARAM].getValue()) / 10.0f;
-		gainY += module->inputs[Scope::Y_SCALE_INPUT].getVoltage() / 10.0f;
-		auto offsetX = module->params[Scope::X_POS_PARAM].getValue();
-		offsetX += module->inputs[Scope::X_POS_INPUT].getVoltage();
-		auto offsetY = module->params[Scope::Y_POS_PARAM].getValue();
-		offsetY += module->inputs[Scope::Y_POS_INPUT].getVoltage();
+		snapshot = &readSnapshot();
+
+		float gainX, offsetX, gainY, offsetY;
+		getScaling(gainX, offsetX, gainY, offsetY);
 
 		// Draw waveforms
-		if ((bool) module->params[Scope::LISSAJOUS_PARAM].getValue()) {
+		if (module->plotType == Scope::PlotType::SPECTRUM) {
+			submitSpectrum();
+			drawSpectrum(args, spectrum->read(1), nvgRGBA(0xe1, 0x02, 0x78, 0xc0), bounds);
+			drawSpectrum(args, spectrum->read(0), nvgHSLA(module->hue, 0.5f, 0.5f, 200), bounds);
+		} else if (phosphorActive() && phosphor.framebuffer.fb) {
+			compositePhosphor(args, phosphor.framebuffer, bounds);
+			if (!(bool) module->params[Scope::LISSAJOUS_PARAM].getValue())
+				drawTrigOverlay(args, offsetX, gainX, bounds);
+		} else if (kaleidoscopeActive() && kaleidoscopeFramebuffer.fb) {
+			compositeKaleidoscope(args, kaleidoscopeFramebuffer, bounds);
+		} else if ((bool) module->params[Scope::LISSAJOUS_PARAM].getValue()) {
 			// X x Y
-			auto lissajousChannels = std::max(module->channelsX, module->channelsY);
+			// storage only exists for connected channels, pair the others with silence
+			static const float silence[MAX_BUFFER_SIZE] = {};
+			auto &traceX = snapshot->traceX;
+			auto &traceY = snapshot->traceY;
+			auto lissajousChannels = std::max(traceX.channels, traceY.channels);
 			for (auto c = 0; c < lissajousChannels; c++) {
-				drawWaveform(args,
-							 module->bufferX[c],
-							 offsetX,
-							 gainX,
-							 module->bufferY[c],
-							 offsetY,
-							 gainY,
-							 0,
-							 0,
-							 nvgHSLA(module->hue, 0.5f, 0.5f, 200),
-							 bounds);
+				auto bufferX = c < traceX.channels ? traceX.buffer[c] : silence;
+				auto bufferY = c < traceY.channels ? traceY.buffer[c] : silence;
+				// the points are computed once, the reflections are mapped from them
+				transformTrace(bufferX, offsetX, gainX, bufferY, offsetY, gainY, bounds);
+				drawWaveform(args, 0, 0, false, nvgHSLA(module->hue, 0.5f, 0.5f, 200), bounds);
 
 				//draw Kaleidoscope rotations;
 				auto unitRotation = (float) (2.0 * M_PI) / (float) module->kaleidoscope.count;
@@ -691,55 +2235,260 @@ struct ScopeDisplay : ModuleLightWidget {
 					auto hueChange = (i + 1) * unitHueChange;
 					auto reflectionHue = std::fmod(module->hue + hueChange, 1.0f);
 					drawWaveform(args,
-								 module->bufferX[c],
-								 offsetX,
-								 -gainX,
-								 module->bufferY[c],
-								 offsetY,
-								 gainY,
 								 module->kaleidoscope.radius,
 								 (i * unitRotation),
+								 true,
 								 nvgHSLA(reflectionHue, 0.5f, 0.5f, 200),
 								 bounds);
 				}
 			}
 		} else {  //draw normal
 			// Y
-			for (auto c = 0; c < module->channelsY; c++) {
-				drawWaveform(args,
-							 NULL,
-							 0,
-							 0,
-							 module->bufferY[c],
-							 offsetY,
-							 gainY,
-							 0,
-							 0,
-							 nvgRGBA(0xe1, 0x02, 0x78, 0xc0),
-							 bounds);
+			for (auto c = 0; c < snapshot->traceY.channels; c++) {
+				if (snapshot->peakDetect) {
+					drawEnvelope(args,
+								 snapshot->traceY,
+								 c,
+								 offsetY,
+								 gainY,
+								 nvgRGBA(0xe1, 0x02, 0x78, 0xc0),
+								 bounds);
+					continue;
+				}
+				transformTimeTrace(snapshot->traceY, c, offsetY, gainY, bounds);
+				drawWaveform(args, 0, 0, false, nvgRGBA(0xe1, 0x02, 0x78, 0xc0), bounds);
 			}
 
 			// X
-			for (auto c = 0; c < module->channelsX; c++) {
-				drawWaveform(args,
-							 NULL,
-							 0,
-							 0,
-							 module->bufferX[c],
-							 offsetX,
-							 gainX,
-							 0,
-							 0,
-							 nvgHSLA(module->hue, 0.5f, 0.5f, 200),
-							 bounds);
+			for (auto c = 0; c < snapshot->traceX.channels; c++) {
+				if (snapshot->peakDetect) {
+					drawEnvelope(args,
+								 snapshot->traceX,
+								 c,
+								 offsetX,
+								 gainX,
+								 nvgHSLA(module->hue, 0.5f, 0.5f, 200),
+								 bounds);
+					continue;
+				}
+				transformTimeTrace(snapshot->traceX, c, offsetX, gainX, bounds);
+				drawWaveform(args, 0, 0, false, nvgHSLA(module->hue, 0.5f, 0.5f, 200), bounds);
+			}
+
+			drawTrigOverlay(args, offsetX, gainX, bounds);
+		}
+	}
+
+	void drawTrigOverlay(const DrawArgs &args, float offsetX, float gainX, Rect bounds) {
+		auto trigThreshold = module->params[Scope::TRIG_PARAM].getValue();
+		trigThreshold += module->inputs[Scope::TRIG_LEVEL_INPUT].getVoltage();
+		trigThreshold = clamp(trigThreshold, -10.0f, 10.0f);
+		trigThreshold = (trigThreshold + offsetX) * gainX;
+		drawTrig(args, trigThreshold, bounds);
+		if (module->preTrigger > 0.f)
+			drawTrigTime(args, (float) module->preTriggerCount() / (snapshot->bufferSize - 1), bounds);
+	}
+};
+
+/// The pop-out window is painted on a thread of its own with the window's GL context,
+/// so it is paced by vsync and its drawing no longer adds to the Rack UI frame.
+/// It has its own display, fed with the module's sweeps by the UI thread, which also keeps track
+/// of the window's size as GLFW only lets windows be queried from the main thread.
+/// Frames are limited to Scope::popOutFps, and only presented when there is something new to show.
+struct ScopePopOut {
+	/// render times and dropped frames over the last FRAME_HISTORY frames presented
+	struct FrameStats {
+		int frames = 0;
+		int dropped = 0;
+		float average = 0.f;
+		float p99 = 0.f;
+	};
+
+	static const int FRAME_HISTORY = 256;
+
+	GLFWwindow *window;
+	ScopeDisplay display;
+	TripleBuffer<ScopeSnapshot> sweeps;
+	uint64_t forwardedGeneration = 0;
+	std::atomic<int> windowWidth{0};
+	std::atomic<int> windowHeight{0};
+	std::atomic<int> framebufferWidth{0};
+	std::atomic<int> framebufferHeight{0};
+	std::atomic<int> refreshRate{60};
+	// set by the window position callback, the refresh rate is looked up again on the next update
+	bool moved = true;
+	std::atomic<bool> running{true};
+	// written by the render thread, read by the context menu
+	std::mutex statsMutex;
+	float renderTimes[FRAME_HISTORY] = {};
+	bool droppedFrames[FRAME_HISTORY] = {};
+	int framesPresented = 0;
+	std::thread thread;
+
+	ScopePopOut(Scope *module, GLFWwindow *window) : window(window) {
+		display.module = module;
+		display.sweeps = &sweeps;
+		glfwSetWindowUserPointer(window, this);
+		glfwSetWindowPosCallback(window, [](GLFWwindow *window, int, int) {
+			((ScopePopOut *) glfwGetWindowUserPointer(window))->moved = true;
+		});
+		update();
+		thread = std::thread(&ScopePopOut::run, this);
+	}
+
+	~ScopePopOut() {
+		running = false;
+		thread.join();
+		glfwSetWindowPosCallback(window, NULL);
+		glfwSetWindowUserPointer(window, NULL);
+	}
+
+	/// follow the refresh rate of the monitor the middle of the window is on, or the primary one
+	void updateRefreshRate() {
+		int x, y, width, height;
+		glfwGetWindowPos(window, &x, &y);
+		glfwGetWindowSize(window, &width, &height);
+		auto monitor = glfwGetPrimaryMonitor();
+		int count;
+		auto monitors = glfwGetMonitors(&count);
+		for (auto i = 0; i < count; i++) {
+			int monitorX, monitorY;
+			glfwGetMonitorPos(monitors[i], &monitorX, &monitorY);
+			auto mode = glfwGetVideoMode(monitors[i]);
+			if (mode && x + width / 2 >= monitorX && x + width / 2 < monitorX + mode->width
+				&& y + height / 2 >= monitorY && y + height / 2 < monitorY + mode->height) {
+				monitor = monitors[i];
+				break;
+			}
+		}
+		auto mode = glfwGetVideoMode(monitor);
+		if (mode && mode->refreshRate > 0)
+			refreshRate = mode->refreshRate;
+	}
+
+	/// called from the UI thread every step, forwards the latest sweep if it is new
+	void update() {
+		int width, height;
+		glfwGetWindowSize(window, &width, &height);
+		windowWidth = width;
+		windowHeight = height;
+		glfwGetFramebufferSize(window, &width, &height);
+		framebufferWidth = width;
+		framebufferHeight = height;
+		if (moved) {
+			moved = false;
+			updateRefreshRate();
+		}
+
+		auto &latest = display.module->snapshots.read();
+		if (latest.generation == forwardedGeneration)
+			return;
+		sweeps.writeSlot().copyFrom(latest);
+		sweeps.publish();
+		forwardedGeneration = latest.generation;
+	}
+
+	void run() {
+		glfwMakeContextCurrent(window);
+		glfwSwapInterval(1);
+		// Create a NanoVG context for painting the popup window.
+//		auto vg = nvgCreateGL2(NVG_ANTIALIAS | NVG_STENCIL_STROKES | NVG_DEBUG);
+		auto vg = nvgCreateGL2(0);
+		// fonts belong to the NanoVG context they were loaded into, so the trigger text needs its own
+		display.font = std::make_shared<Font>();
+		display.font->loadFile(asset::system("res/fonts/ShareTechMono-Regular.ttf"), vg);
+		auto lastPresent = 0.0;
+		auto presentedLast = false;
+		auto &cache = display.traceCache;
+
+		while (running) {
+			auto frameStart = glfwGetTime();
+			auto fps = display.module->popOutFps;
+			auto period = 1.0 / (fps > 0 ? fps : refreshRate.load());
+
+			// Get the size of the popup window, both the window and the framebuffer.
+			int winWidth = windowWidth, winHeight = windowHeight;
+			int fbWidth = framebufferWidth, fbHeight = framebufferHeight;
+			if (winWidth <= 0 || winHeight <= 0) {
+				// minimised, there is nothing to swap to pace the loop
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+				presentedLast = false;
+				continue;
+			}
+			auto pxRatio = (float) fbWidth / (float) winWidth;
+
+			// the kaleidoscope and phosphor are rendered offscreen before the window's frame is started.
+			// A trace layer that is cached and unchanged has nothing new to present
+			auto wasValid = cache.valid;
+			auto generation = cache.generation;
+			auto parameterGeneration = cache.parameterGeneration;
+			// bounds are in window units, the framebuffers are sized by pxRatio
+			display.renderOffscreen(vg, Rect(0, 0, winWidth, winHeight), pxRatio);
+			if (wasValid && cache.valid && cache.generation == generation
+				&& cache.parameterGeneration == parameterGeneration && !display.phosphorActive()) {
+				presentedLast = false;
+				waitUntil(frameStart + period);
+				continue;
+			}
+
+			// Start painting.
+			glViewport(0, 0, fbWidth, fbHeight);
+			auto alpha = display.module->params[Scope::EXT_WINDOW_ALPHA_PARAM].getValue();
+			glClearColor(0, 0, 0, alpha); //Alpha background
+			glClear(GL_COLOR_BUFFER_BIT);
+			nvgBeginFrame(vg, (float) winWidth, (float) winHeight, pxRatio);
+
+			Widget::DrawArgs context;
+			context.vg = vg;
+			display.drawTraces(context, Rect(0, 0, winWidth, winHeight));
+
+			// Finished painting, waits for vsync
+			nvgEndFrame(vg);
+			auto renderTime = glfwGetTime() - frameStart;
+			glfwSwapBuffers(window);
+
+			// a frame is dropped when it follows the last one by more than one and a half periods
+			auto now = glfwGetTime();
+			{
+				std::lock_guard<std::mutex> lock(statsMutex);
+				auto index = framesPresented % FRAME_HISTORY;
+				renderTimes[index] = (float) renderTime;
+				droppedFrames[index] = presentedLast && now - lastPresent > 1.5 * period;
+				framesPresented++;
 			}
+			lastPresent = now;
+			presentedLast = true;
+			if (fps > 0)
+				waitUntil(frameStart + period);
+		}
+
+		// the framebuffers and NanoVG context go with the GL context
+		display.releaseFramebuffers();
+		display.font.reset();
+		nvgDeleteGL2(vg);
+		glfwMakeContextCurrent(NULL);
+	}
+
+	void waitUntil(double time) {
+		auto wait = time - glfwGetTime();
+		if (wait > 0.0)
+			std::this_thread::sleep_for(std::chrono::microseconds((int64_t) (wait * 1e6)));
+	}
 
-			auto trigThreshold = module->params[Scope::TRIG_PARAM].getValue();
-			trigThreshold += module->inputs[Scope::TRIG_LEVEL_INPUT].getVoltage();
-			trigThreshold = clamp(trigThreshold, -10.0f, 10.0f);
-			trigThreshold = (trigThreshold + offsetX) * gainX;
-			drawTrig(args, trigThreshold, bounds);
+	FrameStats frameStats() {
+		std::lock_guard<std::mutex> lock(statsMutex);
+		FrameStats stats;
+		stats.frames = framesPresented < FRAME_HISTORY ? framesPresented : FRAME_HISTORY;
+		if (stats.frames == 0)
+			return stats;
+		std::vector<float> sorted(renderTimes, renderTimes + stats.frames);
+		std::sort(sorted.begin(), sorted.end());
+		for (auto i = 0; i < stats.frames; i++) {
+			stats.average += sorted[i] / stats.frames;
+			stats.dropped += droppedFrames[i];
 		}
+		stats.p99 = sorted[std::min((int) (stats.frames * 0.99f), stats.frames - 1)];
+		return stats;
 	}
 };
 
@@ -829,10 +2578,29 @@ struct ResolutionMenuItem : MenuItem {
 	int size = 512;
 
 	void onAction(const event::Action &e) override {
+		module->prefill(size, module->peakDetect);
 		module->bufferSize = size;
 	}
 };
 
+struct ControlRateMenuItem : MenuItem {
+	Scope *module;
+	int division = 32;
+
+	void onAction(const event::Action &e) override {
+		module->controlDivision = division;
+	}
+};
+
+struct FadeBandsMenuItem : MenuItem {
+	Scope *module;
+	int bands = 16;
+
+	void onAction(const event::Action &e) override {
+		module->fadeBands = bands;
+	}
+};
+
 struct ExternalTriggerMenuItem : MenuItem {
 	Scope *module;
 
@@ -851,6 +2619,153 @@ struct LineFadeMenuItem : MenuItem {
 	}
 };
 
+struct PeakDetectMenuItem : MenuItem {
+	Scope *module;
+
+	void onAction(const event::Action &e) override {
+		module->prefill(module->bufferSize, !module->peakDetect);
+		module->peakDetect = !module->peakDetect;
+	}
+};
+
+struct PreTriggerMenuItem : MenuItem {
+	Scope *module;
+	float preTrigger;
+
+	void onAction(const event::Action &e) override {
+		module->preTrigger = preTrigger;
+	}
+};
+
+struct StatsChannelMenuItem : MenuItem {
+	Scope *module;
+	int channel;
+
+	void onAction(const event::Action &e) override {
+		module->statsChannel = channel;
+	}
+};
+
+struct StatsChannelsMenuItem : MenuItem {
+	Scope *module;
+
+	Menu *createChildMenu() override {
+		auto *menu = new Menu;
+		for (auto channel = -1; channel < PORT_MAX_CHANNELS; channel++) {
+			auto *item = new StatsChannelMenuItem();
+			item->text = channel < 0 ? "All" : string::f("%d", channel + 1);
+			item->rightText = CHECKMARK(module->statsChannel == channel);
+			item->module = module;
+			item->channel = channel;
+			menu->addChild(item);
+		}
+		return menu;
+	}
+};
+
+struct SpectrumSizeMenuItem : MenuItem {
+	Scope *module;
+	int spectrumSize;
+
+	void onAction(const event::Action &e) override {
+		module->spectrumSize = spectrumSize;
+	}
+};
+
+struct SpectrumSizesMenuItem : MenuItem {
+	Scope *module;
+
+	Menu *createChildMenu() override {
+		auto *menu = new Menu;
+		for (auto size : {512, 1024, 2048, 4096, 8192}) {
+			auto *item = new SpectrumSizeMenuItem();
+			item->text = string::f("%d", size);
+			item->rightText = CHECKMARK(module->spectrumSize == size);
+			item->module = module;
+			item->spectrumSize = size;
+			menu->addChild(item);
+		}
+		return menu;
+	}
+};
+
+struct SpectrumOverlapMenuItem : MenuItem {
+	Scope *module;
+	float spectrumOverlap;
+
+	void onAction(const event::Action &e) override {
+		module->spectrumOverlap = spectrumOverlap;
+	}
+};
+
+struct SpectrumOverlapsMenuItem : MenuItem {
+	Scope *module;
+
+	Menu *createChildMenu() override {
+		auto *menu = new Menu;
+		for (auto overlap : {0.f, 0.5f, 0.75f}) {
+			auto *item = new SpectrumOverlapMenuItem();
+			item->text = string::f("%d%%", (int) std::round(overlap * 100));
+			item->rightText = CHECKMARK(module->spectrumOverlap == overlap);
+			item->module = module;
+			item->spectrumOverlap = overlap;
+			menu->addChild(item);
+		}
+		return menu;
+	}
+};
+
+struct SpectrumLogFrequencyMenuItem : MenuItem {
+	Scope *module;
+
+	void onAction(const event::Action &e) override {
+		module->spectrumLogFrequency = !module->spectrumLogFrequency;
+	}
+};
+
+struct PopOutFrameRateMenuItem : MenuItem {
+	Scope *module;
+	int fps = 0;
+
+	void onAction(const event::Action &e) override {
+		module->popOutFps = fps;
+	}
+};
+
+struct PopOutFrameRatesMenuItem : MenuItem {
+	Scope *module;
+
+	Menu *createChildMenu() override {
+		auto *menu = new Menu;
+		for (auto fps : {0, 15, 30, 60, 120}) {
+			auto *item = new PopOutFrameRateMenuItem();
+			item->text = fps == 0 ? "Display refresh" : string::f("%d fps", fps);
+			item->rightText = CHECKMARK(module->popOutFps == fps);
+			item->module = module;
+			item->fps = fps;
+			menu->addChild(item);
+		}
+		return menu;
+	}
+};
+
+struct GpuLinesMenuItem : MenuItem {
+	Scope *module;
+
+	void onAction(const event::Action &e) override {
+		module->gpuLines = !module->gpuLines;
+	}
+};
+
+struct PersistenceMenuItem : MenuItem {
+	Scope *module;
+	float persistence;
+
+	void onAction(const event::Action &e) override {
+		module->persistence = persistence;
+	}
+};
+
 struct ShowStatsMenuItem : MenuItem {
 	Scope *module;
 
@@ -900,7 +2815,7 @@ struct ScopeWidget : ModuleWidget, IPopupWindowOwner {
 	ResizeTab rt;
 	ScopeDisplay *display;
 	GLFWwindow *_window = nullptr;  // Handle to the popup window.
-	NVGcontext *_vg = nullptr;        // For painting into the popup window.
+	std::unique_ptr<ScopePopOut> popOut; // Paints the popup window on its own thread.
 	std::shared_ptr<Font> _font;    //
 
 	ScopeWidget(Scope *module) {
@@ -963,38 +2878,14 @@ struct ScopeWidget : ModuleWidget, IPopupWindowOwner {
 
 
 	void step() override {
-		//pop-out window is handled here, I would have preferred ScopeDisplay::draw()
-		//but this only updates the external window if the ModuleWidget is displayed
-		//zooming and scrolling in the main window can stop rendering of the external
-		//window
+		//pop-out window is fed from here rather than ScopeDisplay::step, which is only
+		//called while the ModuleWidget is displayed, zooming and scrolling in the main
+		//window would stop the external window updating. It is painted by ScopePopOut
+		// the audio thread never allocates, blocks it ran short of are allocated here
+		gSamplePool.refill();
 		if (_window) {
 			display->externalWindow = true;
-			// Paint the popup window.
-			glfwMakeContextCurrent(_window);
-
-			// Get the size of the popup window, both the window and the framebuffer.
-			int winWidth, winHeight;
-			int fbWidth, fbHeight;
-			float pxRatio;
-			glfwGetWindowSize(_window, &winWidth, &winHeight);
-			glfwGetFramebufferSize(_window, &fbWidth, &fbHeight);
-			pxRatio = (float) fbWidth / (float) winWidth;
-
-			// Start painting.
-			glViewport(0, 0, fbWidth, fbHeight);
-			auto alpha = dynamic_cast<Scope *>(module)->params[Scope::EXT_WINDOW_ALPHA_PARAM].getValue();
-			glClearColor(0, 0, 0, alpha); //Alpha background
-			glClear(GL_COLOR_BUFFER_BIT);
-			nvgBeginFrame(_vg, (float) winWidth, (float) winHeight, pxRatio);
-
-			DrawArgs context;
-			context.vg = _vg;
-			display->preDrawWaveforms(context, Rect(0, 0, fbWidth, fbHeight));
-
-			// Finished painting.
-			nvgEndFrame(_vg);
-			glfwSwapBuffers(_window);
-			glfwMakeContextCurrent(APP->window->win);
+			popOut->update();
 
 			// If the user has clicked the window's Close button, close it.
 			if (glfwWindowShouldClose(_window)) {
@@ -1029,31 +2920,24 @@ struct ScopeWidget : ModuleWidget, IPopupWindowOwner {
 
 			// Create the window.
 			_window = glfwCreateWindow(400, 300, "Opsylloscope", NULL, NULL);
-
-
-			// Don't wait for vsync when rendering 'cos it slows down the Rack UI thread.
-			glfwMakeContextCurrent(_window);
-			glfwSwapInterval(0);
+			if (!_window)
+				return;
 
 			// If you want your window to stay on top of other windows.
 //			glfwSetWindowAttrib(_window, GLFW_FLOATING, true);
 
-			// Create a NanoVG context for painting the popup window.
-//			_vg = nvgCreateGL2(NVG_ANTIALIAS | NVG_STENCIL_STROKES | NVG_DEBUG);
-			_vg = nvgCreateGL2(0);
-
-			// Hand OpenGL back to Rack.
-			glfwMakeContextCurrent(APP->window->win);
+			// The window's context is made current on the render thread, which waits for vsync.
+			// The display in the rack stops drawing while the window is open, its framebuffers aren't needed
+			display->releaseFramebuffers();
+			popOut.reset(new ScopePopOut(dynamic_cast<Scope *>(module), _window));
 		}
 	}
 
 	void IPopupWindowOwner_hideWindow() override {
 		if (_window != nullptr) {
-			// Destroy the window and its NanoVG context.
-			glfwMakeContextCurrent(_window);
-			nvgDeleteGL2(_vg);
+			// Stop the render thread, which destroys the NanoVG context, then the window.
+			popOut.reset();
 			glfwDestroyWindow(_window);
-			glfwMakeContextCurrent(APP->window->win);
 			_window = nullptr;
 		}
 	}
@@ -1081,6 +2965,23 @@ struct ScopeWidget : ModuleWidget, IPopupWindowOwner {
 		extWindowAlphaSlider->box.size.x = 200.0f;
 		menu->addChild(extWindowAlphaSlider);
 
+		auto *popOutFps = new PopOutFrameRatesMenuItem();
+		popOutFps->text = "Pop-out Frame Rate";
+		popOutFps->rightText = RIGHT_ARROW;
+		popOutFps->module = module;
+		menu->addChild(popOutFps);
+
+		if (popOut) {
+			auto stats = popOut->frameStats();
+			auto *renderTime = new MenuLabel();
+			renderTime->text = string::f("Render %.2f ms avg, %.2f ms p99",
+										 stats.average * 1000.f, stats.p99 * 1000.f);
+			menu->addChild(renderTime);
+			auto *dropped = new MenuLabel();
+			dropped->text = string::f("Dropped %d of last %d frames", stats.dropped, stats.frames);
+			menu->addChild(dropped);
+		}
+
 		menu->addChild(new MenuEntry);
 
 
@@ -1112,6 +3013,41 @@ struct ScopeWidget : ModuleWidget, IPopupWindowOwner {
 		kaleidoscope->module = module;
 		menu->addChild(kaleidoscope);
 
+		auto *spectrumPlotType = new PlotTypeMenuItem();
+		spectrumPlotType->plotType = Scope::PlotType::SPECTRUM;
+		spectrumPlotType->text = "Spectrum";
+		spectrumPlotType->rightText = CHECKMARK(
+				module->params[Scope::PLOT_TYPE_PARAM].getValue() == Scope::PlotType::SPECTRUM);
+		spectrumPlotType->module = module;
+		menu->addChild(spectrumPlotType);
+
+		menu->addChild(new MenuEntry);
+
+		auto *spectrumLabel = new MenuLabel();
+		spectrumLabel->text = "Spectrum";
+		menu->addChild(spectrumLabel);
+
+		auto *spectrumSizes = new SpectrumSizesMenuItem();
+		spectrumSizes->text = "FFT Size";
+		spectrumSizes->rightText = RIGHT_ARROW;
+		spectrumSizes->module = module;
+		menu->addChild(spectrumSizes);
+
+		// segments are as long as the FFT, a sweep no longer than it is a single segment with nothing to overlap
+		if (module->spectrumSize < module->bufferSize) {
+			auto *spectrumOverlaps = new SpectrumOverlapsMenuItem();
+			spectrumOverlaps->text = "Overlap";
+			spectrumOverlaps->rightText = RIGHT_ARROW;
+			spectrumOverlaps->module = module;
+			menu->addChild(spectrumOverlaps);
+		}
+
+		auto *spectrumLogFrequency = new SpectrumLogFrequencyMenuItem();
+		spectrumLogFrequency->text = "Log Frequency";
+		spectrumLogFrequency->rightText = CHECKMARK(module->spectrumLogFrequency);
+		spectrumLogFrequency->module = module;
+		menu->addChild(spectrumLogFrequency);
+
 		menu->addChild(new MenuEntry);
 
 		auto *lineTypeLabel = new MenuLabel();
@@ -1156,18 +3092,73 @@ struct ScopeWidget : ModuleWidget, IPopupWindowOwner {
 
 		menu->addChild(new MenuEntry);
 
+		auto *acquisitionLabel = new MenuLabel();
+		acquisitionLabel->text = "Acquisition";
+		menu->addChild(acquisitionLabel);
+
+		auto *peakDetect = new PeakDetectMenuItem();
+		peakDetect->text = "Peak Detect";
+		peakDetect->rightText = CHECKMARK(module->peakDetect);
+		peakDetect->module = module;
+		menu->addChild(peakDetect);
+
+		if (module->storageShort) {
+			auto *storageLabel = new MenuLabel();
+			storageLabel->text = "Out of sample memory, some channels not captured";
+			menu->addChild(storageLabel);
+		}
+
+		auto *preTriggerLabel = new MenuLabel();
+		preTriggerLabel->text = "Pre-trigger";
+		menu->addChild(preTriggerLabel);
+
+		for (auto preTrigger : {0.f, 0.1f, 0.25f, 0.5f, 0.75f}) {
+			auto *preTriggerItem = new PreTriggerMenuItem();
+			preTriggerItem->text = string::f("%d%%", (int) std::round(preTrigger * 100));
+			preTriggerItem->rightText = CHECKMARK(module->preTrigger == preTrigger);
+			preTriggerItem->module = module;
+			preTriggerItem->preTrigger = preTrigger;
+			menu->addChild(preTriggerItem);
+		}
+
+		menu->addChild(new MenuEntry);
+
 		auto *fade = new LineFadeMenuItem();
 		fade->text = "Fade";
 		fade->rightText = CHECKMARK(module->params[Scope::LINE_FADE_PARAM].getValue());
 		fade->module = module;
 		menu->addChild(fade);
 
+		auto *persistenceLabel = new MenuLabel();
+		persistenceLabel->text = "Persistence";
+		menu->addChild(persistenceLabel);
+
+		for (auto persistence : {0.f, 0.1f, 0.5f, 2.f, -1.f}) {
+			auto *persistenceItem = new PersistenceMenuItem();
+			if (persistence == 0.f)
+				persistenceItem->text = "Off";
+			else if (persistence < 0.f)
+				persistenceItem->text = "Infinite";
+			else
+				persistenceItem->text = string::f("%gs", persistence);
+			persistenceItem->rightText = CHECKMARK(module->persistence == persistence);
+			persistenceItem->module = module;
+			persistenceItem->persistence = persistence;
+			menu->addChild(persistenceItem);
+		}
+
 		auto *showStats = new ShowStatsMenuItem();
 		showStats->text = "Show Stats";
 		showStats->rightText = CHECKMARK(module->params[Scope::SHOW_STATS_PARAM].getValue());
 		showStats->module = module;
 		menu->addChild(showStats);
 
+		auto *statsChannels = new StatsChannelsMenuItem();
+		statsChannels->text = "Stats Channel";
+		statsChannels->rightText = RIGHT_ARROW;
+		statsChannels->module = module;
+		menu->addChild(statsChannels);
+
 		auto *showLabels = new ShowLabelsMenuItem();
 		showLabels->text = "Show Labels";
 		showLabels->rightText = CHECKMARK(module->params[Scope::SHOW_LABELS_PARAM].getValue());
@@ -1207,6 +3198,42 @@ struct ScopeWidget : ModuleWidget, IPopupWindowOwner {
 		resolution4096->text = "Ultra";
 		resolution4096->rightText = CHECKMARK(module->bufferSize == 4096);
 		menu->addChild(resolution4096);
+
+		auto *gpuLines = new GpuLinesMenuItem();
+		gpuLines->module = module;
+		gpuLines->text = "GPU Lines";
+		gpuLines->rightText = CHECKMARK(module->gpuLines);
+		menu->addChild(gpuLines);
+
+		menu->addChild(new MenuEntry);
+
+		auto *fadeBandsLabel = new MenuLabel();
+		fadeBandsLabel->text = "Fade Steps";
+		menu->addChild(fadeBandsLabel);
+
+		for (auto bands : {8, 16, 32, 0}) {
+			auto *fadeBandsItem = new FadeBandsMenuItem();
+			fadeBandsItem->module = module;
+			fadeBandsItem->bands = bands;
+			fadeBandsItem->text = bands == 0 ? "Every segment" : string::f("%d", bands);
+			fadeBandsItem->rightText = CHECKMARK(module->fadeBands == bands);
+			menu->addChild(fadeBandsItem);
+		}
+
+		menu->addChild(new MenuEntry);
+
+		auto *controlRateLabel = new MenuLabel();
+		controlRateLabel->text = "Parameter Update";
+		menu->addChild(controlRateLabel);
+
+		for (auto division : {1, 16, 32, 64, 128}) {
+			auto *controlRate = new ControlRateMenuItem();
+			controlRate->module = module;
+			controlRate->division = division;
+			controlRate->text = division == 1 ? "Every sample" : string::f("Every %d samples", division);
+			controlRate->rightText = CHECKMARK(module->controlDivision == division);
+			menu->addChild(controlRate);
+		}
 	}
 };
 
@@ -0,0 +1,121 @@
+#include "Spectrum.hpp"
+
+MFSpectrum::MFSpectrum() {
+	thread = std::thread([this]() {
+		run();
+	});
+}
+
+MFSpectrum::~MFSpectrum() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = false;
+	}
+	condition.notify_one();
+	thread.join();
+}
+
+void MFSpectrum::submit(int signal, const float *const *rings, int channels, int start, int size, int fftSize,
+						float overlap) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		Job &job = jobs[signal];
+		job.samples.resize(channels * size);
+		for (int c = 0; c < channels; c++) {
+			for (int i = 0; i < size; i++)
+				job.samples[c * size + i] = rings[c][(start + i) & (size - 1)];
+		}
+		job.channels = channels;
+		job.size = size;
+		job.fftSize = fftSize;
+		job.overlap = overlap;
+		job.pending = true;
+	}
+	condition.notify_one();
+}
+
+const MFSpectrum::Result &MFSpectrum::read(int signal) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (fresh[signal]) {
+		std::swap(front[signal], ready[signal]);
+		fresh[signal] = false;
+	}
+	return front[signal];
+}
+
+void MFSpectrum::run() {
+	Job job;
+	Result result;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		condition.wait(lock, [this]() {
+			return !running || jobs[0].pending || jobs[1].pending;
+		});
+		if (!running)
+			return;
+		for (int signal = 0; signal < NUM_SIGNALS; signal++) {
+			if (!jobs[signal].pending)
+				continue;
+			jobs[signal].pending = false;
+			std::swap(job, jobs[signal]);
+
+			lock.unlock();
+			analyse(job, result);
+			result.sequence = ++sequence;
+			lock.lock();
+			std::swap(ready[signal], result);
+			fresh[signal] = true;
+		}
+	}
+}
+
+void MFSpectrum::analyse(const Job &job, Result &result) {
+	int length = job.fftSize;
+	if (length != fftSize) {
+		fft.reset(new dsp::RealFFT(length));
+		fftSize = length;
+		segment.resize(length);
+		transform.resize(length);
+		power.resize(length / 2);
+	}
+	// sweeps shorter than the FFT are windowed as they are and zero padded
+	int windowLength = std::min(job.size, length);
+	if ((int) window.size() != windowLength) {
+		window.resize(windowLength);
+		for (int i = 0; i < windowLength; i++)
+			window[i] = dsp::hann((float) i / (windowLength - 1));
+	}
+	float windowSum = 0.f;
+	for (float w : window)
+		windowSum += w;
+
+	int bins = length / 2;
+	int hop = std::max((int) (windowLength * (1.f - job.overlap)), 1);
+	result.channels = job.channels;
+	result.bins = bins;
+	result.magnitudes.resize(job.channels * bins);
+
+	for (int c = 0; c < job.channels; c++) {
+		const float *samples = &job.samples[c * job.size];
+		std::fill(power.begin(), power.end(), 0.f);
+		// segments are laid out back from the newest sample
+		int segments = 0;
+		for (int start = job.size - windowLength; start >= 0; start -= hop) {
+			for (int i = 0; i < length; i++)
+				segment[i] = i < windowLength ? samples[start + i] * window[i] : 0.f;
+			fft->rfft(segment.data(), transform.data());
+			// RealFFT::rfft packs the DC bin first, then the real and imaginary parts of each bin
+			power[0] += transform[0] * transform[0];
+			for (int k = 1; k < bins; k++)
+				power[k] += transform[2 * k] * transform[2 * k] + transform[2 * k + 1] * transform[2 * k + 1];
+			segments++;
+		}
+
+		// scaled so a sine of amplitude A reads as A
+		float scale = 2.f / windowSum;
+		for (int k = 0; k < bins; k++) {
+			float amplitude = std::sqrt(power[k] / segments) * scale;
+			result.magnitudes[c * bins + k] = 20.f * std::log10(std::fmax(amplitude, 1e-6f));
+		}
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "rack.hpp"
+
+using namespace rack;
+
+// Windowed magnitude spectra of scope sweeps, computed on a worker thread.
+// Overlapping segments of the sweep are averaged (Welch's method).
+// Each signal's result is double buffered: the worker fills one while the display reads the other.
+struct MFSpectrum {
+	static const int NUM_SIGNALS = 2;
+
+	struct Result {
+		int channels = 0;
+		int bins = 0;
+		// channels * bins magnitudes in dB relative to 1V
+		std::vector<float> magnitudes;
+		// counts the results produced, so readers can tell a new one
+		uint64_t sequence = 0;
+	};
+
+	MFSpectrum();
+	~MFSpectrum();
+	// copy each channel's ring of size samples, oldest first from start, to be analysed as signal.
+	// Replaces any sweep of the same signal that is still waiting
+	// Segments are fftSize long, so overlap only applies to sweeps longer than the FFT
+	void submit(int signal, const float *const *rings, int channels, int start, int size, int fftSize,
+				float overlap);
+	// latest result for signal, stays valid until the next call to read for that signal
+	const Result &read(int signal);
+
+private:
+	struct Job {
+		std::vector<float> samples;
+		int channels = 0;
+		int size = 0;
+		int fftSize = 0;
+		float overlap = 0.f;
+		bool pending = false;
+	};
+
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::thread thread;
+	bool running = true;
+	Job jobs[NUM_SIGNALS];
+	// the worker swaps finished results in as ready, the display swaps them out to front
+	Result ready[NUM_SIGNALS];
+	Result front[NUM_SIGNALS];
+	bool fresh[NUM_SIGNALS] = {};
+	// owned by the worker
+	uint64_t sequence = 0;
+	std::unique_ptr<dsp::RealFFT> fft;
+	int fftSize = 0;
+	std::vector<float> window;
+	std::vector<float> segment;
+	std::vector<float> transform;
+	std::vector<float> power;
+
+	void run();
+	void analyse(const Job &job, Result &result);
+};
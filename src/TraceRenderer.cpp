@@ -0,0 +1,295 @@
+#include "TraceRenderer.hpp"
+
+#define GLEW_STATIC
+
+#include <GL/glew.h>
+
+namespace {
+
+enum Attribute {
+	CORNER,
+	TO,
+	FROM,
+	SEGMENT
+};
+
+enum Uniform {
+	VIEW_SIZE,
+	PIXEL_RATIO,
+	REFLECTION,
+	REFLECTION_OFFSET,
+	TRANSLATION,
+	WEIGHTS,
+	STEPS,
+	COUNT,
+	FADE,
+	LINE_WIDTH,
+	MAX_ALPHA,
+	COLOR
+};
+
+// in the order of Uniform
+const char *uniformNames[] = {"viewSize", "pixelRatio", "reflection", "reflectionOffset", "translation", "weights",
+							  "steps", "count", "fade", "lineWidth", "maxAlpha", "color"};
+
+// segment count the segment index buffer is first made for, it grows with the traces
+const int INITIAL_SEGMENTS = 4096;
+
+const char *vertexShader = R"(
+#version 120
+attribute vec2 corner;
+attribute vec2 to;
+attribute vec2 from;
+attribute float segment;
+uniform vec2 viewSize;
+uniform float pixelRatio;
+uniform mat2 reflection;
+uniform vec2 reflectionOffset;
+uniform vec2 translation;
+uniform vec2 weights;
+uniform vec3 steps;
+uniform float count;
+uniform float fade;
+uniform float lineWidth;
+uniform float maxAlpha;
+varying float alpha;
+varying float side;
+varying float halfWidth;
+
+void main() {
+	float age = mod(steps.x - segment + count, count);
+	vec2 end = reflection * to + reflectionOffset;
+	vec2 start = weights.x * (reflection * from + reflectionOffset) + weights.y * end;
+	start += translation;
+	end += translation;
+
+	float width = (lineWidth - fade * age * lineWidth / count) * pixelRatio;
+	alpha = maxAlpha - fade * age * maxAlpha / count;
+	// lines thinner than a pixel are drawn a pixel wide and fainter, as nanovg does
+	if (width < 1.0) {
+		alpha *= max(width, 0.0);
+		width = 1.0;
+	}
+	if (age < steps.y || age >= steps.z)
+		alpha = 0.0;
+
+	vec2 direction = end - start;
+	float len = length(direction);
+	vec2 along = len > 0.0 ? direction / len : vec2(1.0, 0.0);
+	vec2 normal = vec2(-along.y, along.x);
+	// a pixel either side is left for antialiasing
+	halfWidth = 0.5 * width;
+	side = corner.y * (halfWidth + 1.0);
+	vec2 p = mix(start, end, corner.x) + normal * side / pixelRatio;
+	gl_Position = vec4(2.0 * p.x / viewSize.x - 1.0, 1.0 - 2.0 * p.y / viewSize.y, 0.0, 1.0);
+}
+)";
+
+const char *fragmentShader = R"(
+#version 120
+uniform vec3 color;
+varying float alpha;
+varying float side;
+varying float halfWidth;
+
+void main() {
+	float a = alpha * clamp(halfWidth + 0.5 - abs(side), 0.0, 1.0);
+	gl_FragColor = vec4(color * a, a);
+}
+)";
+
+GLuint compileShader(GLenum type, const char *source) {
+	auto shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+	GLint status;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (!status) {
+		char log[512];
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		WARN("Opsylloscope trace shader did not compile: %s", log);
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+}
+
+MFTraceRenderer::~MFTraceRenderer() {
+	release();
+}
+
+bool MFTraceRenderer::create() {
+	if (!GLEW_ARB_instanced_arrays) {
+		INFO("Opsylloscope GPU lines need ARB_instanced_arrays, using nanovg");
+		return false;
+	}
+	auto vertex = compileShader(GL_VERTEX_SHADER, vertexShader);
+	auto fragment = compileShader(GL_FRAGMENT_SHADER, fragmentShader);
+	if (!vertex || !fragment) {
+		glDeleteShader(vertex);
+		glDeleteShader(fragment);
+		return false;
+	}
+	program = glCreateProgram();
+	glAttachShader(program, vertex);
+	glAttachShader(program, fragment);
+	glBindAttribLocation(program, CORNER, "corner");
+	glBindAttribLocation(program, TO, "to");
+	glBindAttribLocation(program, FROM, "from");
+	glBindAttribLocation(program, SEGMENT, "segment");
+	glLinkProgram(program);
+	glDeleteShader(vertex);
+	glDeleteShader(fragment);
+	GLint status;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		WARN("Opsylloscope trace shader did not link");
+		glDeleteProgram(program);
+		program = 0;
+		return false;
+	}
+	static_assert(COLOR + 1 == NUM_UNIFORMS && sizeof(uniformNames) / sizeof(uniformNames[0]) == NUM_UNIFORMS,
+				  "a location for every uniform");
+	for (auto i = 0; i < NUM_UNIFORMS; i++)
+		uniforms[i] = glGetUniformLocation(program, uniformNames[i]);
+
+	// the quad of a segment, from its start to its end, one side of the line to the other
+	static const float corners[] = {0.f, -1.f, 1.f, -1.f, 0.f, 1.f, 1.f, 1.f};
+	glGenBuffers(1, &cornerBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, cornerBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	glGenBuffers(1, &segmentBuffer);
+	glGenBuffers(1, &pointBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return true;
+}
+
+bool MFTraceRenderer::begin(float width, float height, float pixelRatio) {
+	if (failed)
+		return false;
+	if (!created) {
+		created = true;
+		failed = !create();
+		if (failed) {
+			destroy();
+			return false;
+		}
+	}
+	viewWidth = width;
+	viewHeight = height;
+	this->pixelRatio = pixelRatio;
+	active = true;
+	return true;
+}
+
+void MFTraceRenderer::end() {
+	active = false;
+}
+
+void MFTraceRenderer::upload(const float *x, const float *y, int count, uint64_t generation) {
+	if (generation == pointGeneration && count == pointCount)
+		return;
+	points.resize(2 * count);
+	for (auto i = 0; i < count; i++) {
+		points[2 * i] = x[i];
+		points[2 * i + 1] = y[i];
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, pointBuffer);
+	if (count > pointCapacity) {
+		pointCapacity = std::max(count, INITIAL_SEGMENTS);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 2 * pointCapacity, NULL, GL_STREAM_DRAW);
+
+		// segment indices only change with the capacity
+		std::vector<float> segments(pointCapacity);
+		for (auto i = 0; i < pointCapacity; i++)
+			segments[i] = i;
+		glBindBuffer(GL_ARRAY_BUFFER, segmentBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * pointCapacity, segments.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, pointBuffer);
+	}
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * 2 * count, points.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	pointCount = count;
+	pointGeneration = generation;
+}
+
+void MFTraceRenderer::draw(const Stroke &stroke) {
+	if (!active || pointCount < 2)
+		return;
+	glUseProgram(program);
+	glUniform2f(uniforms[VIEW_SIZE], viewWidth, viewHeight);
+	glUniform1f(uniforms[PIXEL_RATIO], pixelRatio);
+	glUniformMatrix2fv(uniforms[REFLECTION], 1, GL_FALSE, stroke.reflection);
+	glUniform2f(uniforms[REFLECTION_OFFSET], stroke.reflectionOffset[0], stroke.reflectionOffset[1]);
+	glUniform2f(uniforms[TRANSLATION], stroke.translation[0], stroke.translation[1]);
+	glUniform2f(uniforms[WEIGHTS], stroke.weights[0], stroke.weights[1]);
+	glUniform3f(uniforms[STEPS], stroke.startStep, stroke.firstStep, stroke.stepCount);
+	glUniform1f(uniforms[COUNT], pointCount);
+	glUniform1f(uniforms[FADE], stroke.fade ? 1.f : 0.f);
+	glUniform1f(uniforms[LINE_WIDTH], stroke.lineWidth);
+	glUniform1f(uniforms[MAX_ALPHA], stroke.maxAlpha);
+	glUniform3f(uniforms[COLOR], stroke.color[0], stroke.color[1], stroke.color[2]);
+
+	// additive, like the NVG_LIGHTER strokes of nanovg, with the premultiplied colour of the shader
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_STENCIL_TEST);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glEnable(GL_SCISSOR_TEST);
+	auto targetHeight = viewHeight * pixelRatio;
+	glScissor((GLint) (stroke.scissor[0] * pixelRatio),
+			  (GLint) (targetHeight - (stroke.scissor[1] + stroke.scissor[3]) * pixelRatio),
+			  (GLsizei) (stroke.scissor[2] * pixelRatio),
+			  (GLsizei) (stroke.scissor[3] * pixelRatio));
+
+	glBindBuffer(GL_ARRAY_BUFFER, cornerBuffer);
+	glEnableVertexAttribArray(CORNER);
+	glVertexAttribPointer(CORNER, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, pointBuffer);
+	glEnableVertexAttribArray(TO);
+	glVertexAttribPointer(TO, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glVertexAttribDivisorARB(TO, 1);
+	glEnableVertexAttribArray(FROM);
+	glVertexAttribPointer(FROM, 2, GL_FLOAT, GL_FALSE, 0, (const void *) (2 * sizeof(float)));
+	glVertexAttribDivisorARB(FROM, 1);
+	glBindBuffer(GL_ARRAY_BUFFER, segmentBuffer);
+	glEnableVertexAttribArray(SEGMENT);
+	glVertexAttribPointer(SEGMENT, 1, GL_FLOAT, GL_FALSE, 0, 0);
+	glVertexAttribDivisorARB(SEGMENT, 1);
+
+	// segment k runs from point k + 1 to point k
+	glDrawArraysInstancedARB(GL_TRIANGLE_STRIP, 0, 4, pointCount - 1);
+
+	// nanovg shares the attribute slots and doesn't expect divisors
+	for (auto attribute : {TO, FROM, SEGMENT})
+		glVertexAttribDivisorARB(attribute, 0);
+	for (auto attribute : {CORNER, TO, FROM, SEGMENT})
+		glDisableVertexAttribArray(attribute);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glDisable(GL_SCISSOR_TEST);
+	glUseProgram(0);
+}
+
+void MFTraceRenderer::destroy() {
+	if (program)
+		glDeleteProgram(program);
+	for (auto buffer : {&cornerBuffer, &segmentBuffer, &pointBuffer}) {
+		if (*buffer)
+			glDeleteBuffers(1, buffer);
+		*buffer = 0;
+	}
+	program = 0;
+}
+
+void MFTraceRenderer::release() {
+	destroy();
+	created = false;
+	failed = false;
+	active = false;
+	pointCapacity = 0;
+	pointCount = 0;
+	pointGeneration = UINT64_MAX;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include "rack.hpp"
+
+using namespace rack;
+
+// Draws scope traces with OpenGL rather than nanovg, for offscreen passes only.
+// The points of a trace are uploaded to a vertex buffer once, and every segment is drawn as an
+// instanced quad, positioned, faded and antialiased by the shader. Reflections of the same trace are
+// further draws of the same buffer with another transform.
+// Needs ARB_instanced_arrays, begin returns false where it isn't available so nanovg can be used instead.
+// All calls need the GL context the renderer was first used with to be current.
+struct MFTraceRenderer {
+	// how the segments of the uploaded trace are drawn, see ScopeDisplay::drawWaveform
+	struct Stroke {
+		float color[3] = {1.f, 1.f, 1.f};
+		float lineWidth = 1.f;
+		float maxAlpha = 1.f;
+		// fade alpha and width from the head of the sweep
+		bool fade = false;
+		// segment k is drawn at step (startStep - k) mod count, when firstStep <= step < stepCount
+		int startStep = 0;
+		int firstStep = 0;
+		int stepCount = 0;
+		// a segment starts at weights[0] * its previous point + weights[1] * its point, for the line types
+		float weights[2] = {1.f, 0.f};
+		// points are mapped by this column major matrix and offset, then translated
+		float reflection[4] = {1.f, 0.f, 0.f, 1.f};
+		float reflectionOffset[2] = {0.f, 0.f};
+		float translation[2] = {0.f, 0.f};
+		// x, y, width and height, in the units of the target
+		float scissor[4] = {0.f, 0.f, 0.f, 0.f};
+	};
+
+	MFTraceRenderer() = default;
+	MFTraceRenderer(const MFTraceRenderer &) = delete;
+	MFTraceRenderer &operator=(const MFTraceRenderer &) = delete;
+	~MFTraceRenderer();
+
+	// start drawing into the bound framebuffer, of the given size in units of pixelRatio pixels
+	bool begin(float width, float height, float pixelRatio);
+	void end();
+	bool drawing() const {
+		return active;
+	}
+	// copy a trace's points to the vertex buffer, unless the points of generation are there already
+	void upload(const float *x, const float *y, int count, uint64_t generation);
+	void draw(const Stroke &stroke);
+	void release();
+
+private:
+	bool create();
+	void destroy();
+
+	bool created = false;
+	bool failed = false;
+	bool active = false;
+	unsigned program = 0;
+	// locations of the shader's uniforms, looked up once when it is linked
+	static const int NUM_UNIFORMS = 12;
+	int uniforms[NUM_UNIFORMS] = {};
+	unsigned cornerBuffer = 0;
+	unsigned segmentBuffer = 0;
+	unsigned pointBuffer = 0;
+	int pointCapacity = 0;
+	int pointCount = 0;
+	uint64_t pointGeneration = UINT64_MAX;
+	std::vector<float> points;
+	float viewWidth = 1.f;
+	float viewHeight = 1.f;
+	float pixelRatio = 1.f;
+};